@@ -0,0 +1,17 @@
+#version 150
+
+// Single pass theta blending: both theta levels of one tile are sampled
+// at once and mixed by the tileset's blendAlpha, as blend.frag does for
+// the full screen targets of the fbo render path.
+uniform sampler2DRect texA;
+uniform sampler2DRect texB;
+uniform float alpha;
+
+in vec2 texCoordVarying;
+out vec4 fragColor;
+
+void main() {
+    vec4 colorA = texture(texA, texCoordVarying);
+    vec4 colorB = texture(texB, texCoordVarying);
+    fragColor = mix(colorA, colorB, alpha);
+}
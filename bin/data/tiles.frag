@@ -0,0 +1,20 @@
+#version 150
+
+// Both theta levels of a tile from the tile atlas, mixed as in tile.frag.
+// Coordinates stay half a texel inside the tile, so linear filtering does
+// not pick up the unused rest of the slot.
+uniform sampler2DArray atlas;
+uniform vec2 slotSize;
+
+in vec2 texCoordVarying;
+flat in vec2 texCoordMax;
+flat in vec3 layerAlpha;
+
+out vec4 fragColor;
+
+void main() {
+    vec2 texCoord = clamp(texCoordVarying, 0.5 / slotSize, texCoordMax);
+    vec4 colorA = texture(atlas, vec3(texCoord, layerAlpha.x));
+    vec4 colorB = texture(atlas, vec3(texCoord, layerAlpha.y));
+    fragColor = mix(colorA, colorB, layerAlpha.z);
+}
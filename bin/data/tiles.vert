@@ -0,0 +1,21 @@
+#version 150
+
+// Batched render path: every instance is one tile, `position` a corner of
+// the unit quad. Tiles sit in the top left corner of their atlas slot.
+uniform mat4 modelViewProjectionMatrix;
+uniform vec2 slotSize;
+
+in vec4 position;
+in vec4 rect;   // world position and size
+in vec3 layers; // atlas layers of t1 and t2, blend alpha
+
+out vec2 texCoordVarying;
+flat out vec2 texCoordMax;
+flat out vec3 layerAlpha;
+
+void main() {
+    texCoordVarying = position.xy * rect.zw / slotSize;
+    texCoordMax = (rect.zw - 0.5) / slotSize;
+    layerAlpha = layers;
+    gl_Position = modelViewProjectionMatrix * vec4(rect.xy + position.xy * rect.zw, 0.0, 1.0);
+}
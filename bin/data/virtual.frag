@@ -0,0 +1,54 @@
+#version 150
+
+// Looks the page under the fragment up in the page tables of both theta
+// levels and blends the two as tile.frag does. Table entries are the
+// atlas layer plus one, 0 for pages that are not resident yet. A page
+// resident at only one theta level is drawn on its own, one resident at
+// neither is taken from the next coarser zoom level.
+uniform sampler2DArray atlas;
+uniform usampler2D pageTableA;
+uniform usampler2D pageTableB;
+uniform usampler2D coarseTableA;
+uniform usampler2D coarseTableB;
+uniform vec2 slotSize;
+uniform vec2 gridOrigin;
+uniform float pageSize;
+uniform ivec2 numPages;
+uniform vec2 coarseScale;
+uniform vec2 coarseGridOrigin;
+uniform float coarsePageSize;
+uniform ivec2 coarseNumPages;
+uniform float alpha;
+
+in vec2 localVarying;
+out vec4 fragColor;
+
+// `pixel` is relative to the grid origin of the level
+bool samplePage(usampler2D tableA, usampler2D tableB, vec2 pixel, float size, ivec2 pages, out vec4 color) {
+    color = vec4(0.0);
+    ivec2 page = ivec2(floor(pixel / size));
+    if (any(lessThan(page, ivec2(0))) || any(greaterThanEqual(page, pages)))
+        return false;
+
+    uint layerA = texelFetch(tableA, page, 0).r;
+    uint layerB = texelFetch(tableB, page, 0).r;
+    if (layerA == 0u && layerB == 0u)
+        return false;
+    if (layerA == 0u)
+        layerA = layerB;
+    if (layerB == 0u)
+        layerB = layerA;
+
+    vec2 texCoord = clamp(pixel - vec2(page) * size, 0.5, size - 0.5) / slotSize;
+    vec4 colorA = texture(atlas, vec3(texCoord, float(layerA - 1u)));
+    vec4 colorB = texture(atlas, vec3(texCoord, float(layerB - 1u)));
+    color = mix(colorA, colorB, alpha);
+    return true;
+}
+
+void main() {
+    if (samplePage(pageTableA, pageTableB, localVarying - gridOrigin, pageSize, numPages, fragColor))
+        return;
+    if (!samplePage(coarseTableA, coarseTableB, localVarying * coarseScale - coarseGridOrigin, coarsePageSize, coarseNumPages, fragColor))
+        discard;
+}
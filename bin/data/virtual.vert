@@ -0,0 +1,15 @@
+#version 150
+
+// Virtual texture render path: a tileset is drawn as one quad, the
+// fragment shaders work in pixels of the tileset's current zoom level.
+uniform mat4 modelViewProjectionMatrix;
+uniform vec2 offset;
+
+in vec4 position;
+
+out vec2 localVarying;
+
+void main() {
+    localVarying = position.xy - offset;
+    gl_Position = modelViewProjectionMatrix * position;
+}
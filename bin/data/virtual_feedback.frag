@@ -0,0 +1,20 @@
+#version 150
+
+// Feedback pass of the virtual texture: writes the tileset id plus one
+// and the page under the fragment, decoded in VirtualTexture::collect.
+uniform int tileset;
+uniform vec2 gridOrigin;
+uniform float pageSize;
+uniform ivec2 numPages;
+
+in vec2 localVarying;
+out vec4 fragColor;
+
+void main() {
+    ivec2 page = ivec2(floor((localVarying - gridOrigin) / pageSize));
+    if (any(lessThan(page, ivec2(0))) || any(greaterThanEqual(page, numPages)))
+        discard;
+
+    uvec2 p = uvec2(page);
+    fragColor = vec4(float(tileset + 1), float(p.x & 255u), float(p.y & 255u), float((p.x >> 8) | ((p.y >> 8) << 4))) / 255.0;
+}
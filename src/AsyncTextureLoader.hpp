@@ -1,92 +1,420 @@
+#pragma once
+
 #include "ofMain.h"
+#include "CompressedTile.hpp"
+#include "PixelBufferPool.hpp"
+#include "PixelUploadRing.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
 #include <unordered_set>
 
-class AsyncTextureLoader : public ofThread
+class AsyncTextureLoader
 {
 public:
-    using LoadCallback = std::function<void(const std::string &, ofImage)>;
+    using LoadCallback = std::function<void(const std::string &, ofTexture &)>;
+    using PixelsCallback = std::function<void(const std::string &, const ofPixels &)>;
 
-    AsyncTextureLoader()
+    struct UploadStats
     {
-        startThread();
-    }
+        size_t backlog = 0;
+        size_t uploadedLastFrame = 0;
+        float uploadTimeMs = 0.f;     // main thread time spent uploading last frame
+        float uploadLatencyMs = 0.f;  // decoded -> uploaded (moving average)
+        float requestLatencyMs = 0.f; // requested -> uploaded (moving average)
+    };
+
+    AsyncTextureLoader() {}
 
     ~AsyncTextureLoader()
     {
         stop();
     }
 
-    void requestLoad(const std::string &path, LoadCallback callback)
+    void setup(size_t numWorkers)
     {
-        if (pendingSet.count(path))
+        if (workers.size())
             return;
 
-        pendingSet.insert(path);
-        loadRequests.send({path, callback});
+        numWorkers = std::max<size_t>(numWorkers, 1);
+        ofLogNotice() << "AsyncTextureLoader starting " << numWorkers << " decode workers";
+
+        // Decoded tiles waiting for upload hold on to their buffer, so a
+        // full pool makes the workers wait for the upload stage to catch up
+        pixelPool.setup(std::max<size_t>(numWorkers * 2, 8));
+
+        for (size_t i = 0; i < numWorkers; i++)
+        {
+            workers.push_back(std::make_unique<Worker>(*this));
+            workers.back()->startThread();
+        }
+    }
+
+    /*
+        Queue `path` for decoding, or refresh its priority if it is already
+        queued. Higher priorities are decoded first. Requests that are not
+        renewed for `staleFrames` calls to nextFrame() are cancelled before
+        they reach a worker.
+    */
+    void requestLoad(const std::string &path, float priority, LoadCallback callback)
+    {
+        request(path, priority, std::move(callback), nullptr);
+    }
+
+    // As requestLoad, but the decoded pixels are handed over without
+    // creating a texture, for callers uploading into textures of their own
+    void requestPixels(const std::string &path, float priority, PixelsCallback callback)
+    {
+        request(path, priority, nullptr, std::move(callback));
+    }
+
+    /*
+        Called once per frame before requesting tiles. Cancels requests that
+        have not been renewed recently and reorders the rest by their latest
+        priority.
+    */
+    void nextFrame()
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+
+        frame++;
+
+        std::erase_if(queue, [this](const QueueEntry &entry)
+                      {
+                          if (!isStale(*entry.request))
+                              return false;
+
+                          queued.erase(entry.request->path);
+                          numCancelled++;
+                          return true; });
+
+        for (QueueEntry &entry : queue)
+            entry.priority = entry.request->priority;
+
+        std::make_heap(queue.begin(), queue.end());
     }
 
     void stop()
     {
-        loadRequests.close();
-        waitForThread();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            closed = true;
+            queue.clear();
+            queued.clear();
+        }
+        queueCondition.notify_all();
+        pixelPool.close();
+
+        for (auto &worker : workers)
+            worker->waitForThread();
+
+        workers.clear();
+        loadResults.close();
     }
 
-    void dispatchMainCallbacks(int maxCount)
+    /*
+        Uploads decoded tiles to the GPU and runs their callbacks until
+        `budgetMs` has been spent. At least one tile is uploaded per call so
+        the backlog always drains.
+    */
+    void uploadResults(float budgetMs)
     {
-        int n = 0;
+        uint64_t start = ofGetElapsedTimeMicros();
+        uint64_t budget = static_cast<uint64_t>(budgetMs * 1000.f);
+        uint64_t now = start;
+
+        stats.uploadedLastFrame = 0;
         LoadResult result;
-        while (n < maxCount && loadResults.tryReceive(result))
+        do
         {
-            auto &[path, pixels, callback] = result;
+            if (!loadResults.tryReceive(result))
+                break;
+            backlog--;
 
-            // Allocate and upload to GPU on main thread
-            ofImage tile;
-            tile.setFromPixels(pixels);
+            ofTexture texture;
+            if (result.pixelsCallback)
+                result.pixelsCallback(result.path, pixelPool[result.buffer]);
+            else if (result.compressed.dataBytes > 0)
+                CompressedTile::upload(result.compressed, pixelPool[result.buffer].getData(), texture);
+            else
+                uploadRing.upload(pixelPool[result.buffer], texture);
+            pixelPool.release(result.buffer);
+            finished(result.path);
 
-            callback(path, tile);
-            n++;
-        }
+            now = ofGetElapsedTimeMicros();
+            float uploadLatency = (now - result.decodedTime) / 1000.f;
+            float requestLatency = (now - result.requestTime) / 1000.f;
+            stats.uploadLatencyMs = ofLerp(stats.uploadLatencyMs, uploadLatency, 0.05f);
+            stats.requestLatencyMs = ofLerp(stats.requestLatencyMs, requestLatency, 0.05f);
+
+            if (result.callback)
+                result.callback(result.path, texture);
+            stats.uploadedLastFrame++;
+        } while (now - start < budget);
+
+        stats.uploadTimeMs = (ofGetElapsedTimeMicros() - start) / 1000.f;
+        stats.backlog = backlog;
     }
 
-protected:
-    void threadedFunction() override
+    const UploadStats &getUploadStats() const
     {
-        LoadRequest request;
-        while (loadRequests.receive(request))
-        {
-            auto &[path, callback] = request;
+        return stats;
+    }
 
-            ofPixels loadedPixels;
-            if (!ofLoadImage(loadedPixels, path))
-            {
-                ofLogError() << "AsyncTextureLoader failed to load: " << path;
-                pendingSet.erase(path);
-                continue;
-            }
+    size_t numWorkers() const
+    {
+        return workers.size();
+    }
 
-            loadResults.send({path, loadedPixels, callback});
-            pendingSet.erase(path);
-        }
+    size_t numDecoded() const
+    {
+        return decoded;
+    }
 
-        loadResults.close();
+    // Number of times a decode had to grow a file or pixel buffer. This stays
+    // flat in steady state when tiles share a size and format.
+    size_t numDecodeAllocations() const
+    {
+        return decodeAllocations;
+    }
+
+    // Tiles read from their BC1 sidecar instead of decoding the JPEG
+    size_t numCompressed() const
+    {
+        return compressed;
+    }
+
+    size_t numPending()
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        return queued.size() + inFlight.size();
     }
 
+    std::atomic<size_t> numCancelled = 0;
+    uint64_t staleFrames = 2;
+
+    // Texture requests use the tile's BC1 sidecar (see CompressedTile)
+    // when there is one
+    std::atomic<bool> compressedTiles = false;
+
 private:
+    void request(const std::string &path, float priority, LoadCallback callback, PixelsCallback pixelsCallback)
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+
+        if (closed || inFlight.count(path))
+            return;
+
+        auto it = queued.find(path);
+        if (it != queued.end())
+        {
+            it->second->priority = priority;
+            it->second->lastFrame = frame;
+            return;
+        }
+
+        auto entry = std::make_shared<LoadRequest>(LoadRequest{path, std::move(callback), std::move(pixelsCallback), priority, frame, ofGetElapsedTimeMicros()});
+        queued[path] = entry;
+        queue.push_back({priority, entry});
+        std::push_heap(queue.begin(), queue.end());
+
+        queueCondition.notify_one();
+    }
+
     struct LoadRequest
     {
         std::string path;
         LoadCallback callback;
+        PixelsCallback pixelsCallback;
+        float priority;
+        uint64_t lastFrame;
+        uint64_t requestTime;
+    };
+
+    struct QueueEntry
+    {
+        float priority;
+        std::shared_ptr<LoadRequest> request;
+
+        bool operator<(const QueueEntry &other) const
+        {
+            return priority < other.priority;
+        }
     };
 
     struct LoadResult
     {
         std::string path;
-        ofPixels pixels;
+        PixelBufferPool::Handle buffer;
         LoadCallback callback;
+        PixelsCallback pixelsCallback;
+        uint64_t requestTime;
+        uint64_t decodedTime;
+        CompressedTile::Header compressed; // dataBytes is 0 for decoded pixels
     };
 
-    ofThreadChannel<LoadRequest> loadRequests;
+    class Worker : public ofThread
+    {
+    public:
+        Worker(AsyncTextureLoader &l) : loader(l) {}
+
+    protected:
+        void threadedFunction() override
+        {
+            LoadRequest request;
+            PixelBufferPool::Handle buffer;
+
+            while (loader.pixelPool.acquire(buffer))
+            {
+                if (!loader.receive(request))
+                {
+                    loader.pixelPool.release(buffer);
+                    break;
+                }
+
+                // Only texture requests can take compressed blocks
+                CompressedTile::Header compressed{};
+                if (loader.compressedTiles && !request.pixelsCallback && readCompressed(request.path, compressed, loader.pixelPool[buffer]))
+                    loader.compressed++;
+                else if (!decode(request.path, loader.pixelPool[buffer]))
+                {
+                    ofLogError() << "AsyncTextureLoader failed to load: " << request.path;
+                    loader.pixelPool.release(buffer);
+                    loader.finished(request.path);
+                    continue;
+                }
+
+                // The path stays in flight until the upload stage releases
+                // it, so the tile is not requested again while it waits
+                loader.backlog++;
+                loader.decoded++;
+                loader.loadResults.send({std::move(request.path), buffer, std::move(request.callback), std::move(request.pixelsCallback), request.requestTime, ofGetElapsedTimeMicros(), compressed});
+            }
+        }
+
+    private:
+        // False if the tile has no sidecar or it is older than the JPEG,
+        // which stays stale until the next --ingest
+        bool readCompressed(const std::string &path, CompressedTile::Header &header, ofPixels &pixels)
+        {
+            if (!CompressedTile::isCurrent(path))
+                return false;
+
+            const unsigned char *storage = pixels.getData();
+            if (!CompressedTile::read(CompressedTile::sidecarPath(path), header, pixels))
+            {
+                header = {};
+                return false;
+            }
+
+            if (pixels.getData() != storage)
+                loader.decodeAllocations++;
+            return true;
+        }
+
+        bool decode(const std::string &path, ofPixels &pixels)
+        {
+            // Read the file into a buffer owned by this worker so its
+            // allocation is reused from one tile to the next
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            if (!file)
+                return false;
+
+            std::streamsize size = file.tellg();
+            file.seekg(0, std::ios::beg);
+            if (static_cast<size_t>(size) > fileBufferCapacity)
+            {
+                fileBufferCapacity = size;
+                loader.decodeAllocations++;
+            }
+            fileBuffer.allocate(size);
+            if (!file.read(fileBuffer.getData(), size))
+                return false;
+
+            // Decodes straight into the pooled buffer, which keeps its
+            // storage when the tile matches its current size and format
+            const unsigned char *storage = pixels.getData();
+            if (!ofLoadImage(pixels, fileBuffer))
+                return false;
+
+            if (pixels.getData() != storage)
+                loader.decodeAllocations++;
+
+            return true;
+        }
+
+        AsyncTextureLoader &loader;
+        ofBuffer fileBuffer;
+        size_t fileBufferCapacity = 0;
+    };
+
+    bool isStale(const LoadRequest &request) const
+    {
+        return request.lastFrame + staleFrames < frame;
+    }
+
+    // Blocks until the most urgent live request is available, moving it to
+    // the in-flight set. Returns false once the loader is stopped.
+    bool receive(LoadRequest &request)
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+
+        while (true)
+        {
+            queueCondition.wait(lock, [this]
+                                { return closed || queue.size(); });
+
+            if (closed)
+                return false;
+
+            std::pop_heap(queue.begin(), queue.end());
+            std::shared_ptr<LoadRequest> next = std::move(queue.back().request);
+            queue.pop_back();
+            queued.erase(next->path);
+
+            if (isStale(*next))
+            {
+                numCancelled++;
+                continue;
+            }
+
+            inFlight.insert(next->path);
+            request = std::move(*next);
+            return true;
+        }
+    }
+
+    void finished(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        inFlight.erase(path);
+    }
+
+    // Max-heap on priority, shared by all workers. Entries keep a snapshot
+    // of the priority so the heap stays valid while requests are renewed;
+    // nextFrame() refreshes the snapshots.
+    std::vector<QueueEntry> queue;
+    std::unordered_map<std::string, std::shared_ptr<LoadRequest>> queued;
+    std::unordered_set<std::string> inFlight;
+    uint64_t frame = 0;
+    bool closed = false;
+
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+
     ofThreadChannel<LoadResult> loadResults;
+    std::atomic<size_t> backlog = 0;
+
+    PixelBufferPool pixelPool;
+    std::atomic<size_t> decoded = 0;
+    std::atomic<size_t> compressed = 0;
+    std::atomic<size_t> decodeAllocations = 0;
+
+    // Main thread only
+    PixelUploadRing uploadRing;
+    UploadStats stats;
 
-    std::unordered_set<std::string> pendingSet;
+    std::vector<std::unique_ptr<Worker>> workers;
 };
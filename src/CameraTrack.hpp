@@ -0,0 +1,169 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include <filesystem>
+#include <fstream>
+
+/*
+    Camera state for every frame of a sequence, compiled by simulating the
+    sequence once at the recording frame rate (see ofApp::compileTrack).
+    Any frame can then be looked up directly instead of replaying the
+    sequence up to it.
+
+    Stored as `track.bin` in the project folder: Header, the tileset names
+    (each a uint16 length and the characters), then the frames.
+*/
+class CameraTrack
+{
+public:
+    static constexpr char magic[8] = {'T', 'S', 'C', 'T', 'R', 'A', 'C', 'K'};
+    static constexpr uint32_t version = 1;
+
+    struct Frame
+    {
+        // View center in full resolution scan pixels (world coordinates
+        // times the zoom), independent of the zoom level
+        float x;
+        float y;
+        float zoom;
+        float rotation;
+        float theta;
+        uint16_t tileset;
+        uint16_t step;
+    };
+
+    static_assert(sizeof(Frame) == 24);
+
+    void clear()
+    {
+        frames.clear();
+        tilesets.clear();
+    }
+
+    void add(Frame frame, const std::string &tileset)
+    {
+        frame.tileset = tilesetIndex(tileset);
+        frames.push_back(frame);
+    }
+
+    size_t size() const
+    {
+        return frames.size();
+    }
+
+    bool empty() const
+    {
+        return frames.empty();
+    }
+
+    const Frame &operator[](size_t i) const
+    {
+        return frames[i];
+    }
+
+    const std::string &tilesetName(const Frame &frame) const
+    {
+        return tilesets[frame.tileset];
+    }
+
+    float getDuration() const
+    {
+        return fps > 0.f ? frames.size() / fps : 0.f;
+    }
+
+    bool save(const std::filesystem::path &path) const
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+
+        Header header{};
+        std::copy(std::begin(magic), std::end(magic), header.magic);
+        header.version = version;
+        header.fps = fps;
+        header.numTilesets = static_cast<uint32_t>(tilesets.size());
+        header.numFrames = frames.size();
+        out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+
+        for (const std::string &name : tilesets)
+        {
+            uint16_t length = static_cast<uint16_t>(name.size());
+            out.write(reinterpret_cast<const char *>(&length), sizeof(length));
+            out.write(name.data(), length);
+        }
+
+        out.write(reinterpret_cast<const char *>(frames.data()), frames.size() * sizeof(Frame));
+        return static_cast<bool>(out);
+    }
+
+    bool load(const std::filesystem::path &path)
+    {
+        clear();
+
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return false;
+
+        Header header;
+        if (!in.read(reinterpret_cast<char *>(&header), sizeof(Header)) ||
+            !std::equal(std::begin(magic), std::end(magic), header.magic) ||
+            header.version != version)
+            return false;
+
+        fps = header.fps;
+
+        tilesets.resize(header.numTilesets);
+        for (std::string &name : tilesets)
+        {
+            uint16_t length = 0;
+            in.read(reinterpret_cast<char *>(&length), sizeof(length));
+            name.resize(length);
+            in.read(name.data(), length);
+        }
+
+        frames.resize(header.numFrames);
+        if (!in.read(reinterpret_cast<char *>(frames.data()), frames.size() * sizeof(Frame)))
+        {
+            clear();
+            return false;
+        }
+
+        for (const Frame &frame : frames)
+        {
+            if (frame.tileset >= tilesets.size())
+            {
+                clear();
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    float fps = 30.f;
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        float fps;
+        uint32_t numTilesets;
+        uint32_t reserved;
+        uint64_t numFrames;
+    };
+
+    uint16_t tilesetIndex(const std::string &name)
+    {
+        auto it = std::find(tilesets.begin(), tilesets.end(), name);
+        if (it != tilesets.end())
+            return static_cast<uint16_t>(it - tilesets.begin());
+
+        tilesets.push_back(name);
+        return static_cast<uint16_t>(tilesets.size() - 1);
+    }
+
+    std::vector<std::string> tilesets;
+    std::vector<Frame> frames;
+};
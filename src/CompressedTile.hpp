@@ -0,0 +1,311 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include <filesystem>
+#include <fstream>
+
+/*
+    Tiles transcoded to BC1 (DXT1) at ingest time, stored in a sidecar
+    cache next to the tile catalog: `<tileset>/<zoom>.0/<theta>.0/<tile>.jpg`
+    becomes `<tileset>/.bc1/<zoom>.0/<theta>.0/<tile>.bc1`. The folder is
+    hidden so the tile scanners pass it by.
+
+    BC1 takes half a byte per pixel against three for uncompressed RGB and
+    is uploaded as is with glCompressedTexImage2D; every GL driver
+    including Mesa's samples it. A file is a Header followed by the blocks,
+    row by row, eight bytes per 4x4 block.
+*/
+class CompressedTile
+{
+public:
+    static constexpr char magic[8] = {'T', 'S', 'C', 'B', 'C', '1', 0, 0};
+    static constexpr uint32_t version = 1;
+    static constexpr const char *folder = ".bc1";
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t dataBytes;
+    };
+
+    static std::filesystem::path sidecarPath(const std::filesystem::path &tilePath)
+    {
+        std::filesystem::path thetaDir = tilePath.parent_path();
+        std::filesystem::path zoomDir = thetaDir.parent_path();
+        std::filesystem::path path = zoomDir.parent_path() / folder / zoomDir.filename() / thetaDir.filename() / tilePath.filename();
+        path.replace_extension(".bc1");
+        return path;
+    }
+
+    // The sidecar of `tilePath` exists and is at least as new as the tile
+    static bool isCurrent(const std::filesystem::path &tilePath)
+    {
+        std::error_code ec;
+        auto sidecarTime = std::filesystem::last_write_time(sidecarPath(tilePath), ec);
+        if (ec)
+            return false;
+
+        auto tileTime = std::filesystem::last_write_time(tilePath, ec);
+        return !ec && sidecarTime >= tileTime;
+    }
+
+    static size_t dataBytes(size_t width, size_t height)
+    {
+        return ((width + 3) / 4) * ((height + 3) / 4) * 8;
+    }
+
+    // Encodes `pixels` into `dst`, dataBytes() long. They must be RGB or
+    // RGBA; grayscale tiles are converted by the caller.
+    static void encode(const ofPixels &pixels, uint8_t *dst)
+    {
+        size_t width = pixels.getWidth();
+        size_t height = pixels.getHeight();
+        size_t channels = pixels.getNumChannels();
+        const uint8_t *src = pixels.getData();
+
+        uint8_t block[16 * 3];
+        for (size_t by = 0; by < height; by += 4)
+        {
+            for (size_t bx = 0; bx < width; bx += 4)
+            {
+                // Blocks over the edge repeat the last row and column
+                for (size_t y = 0; y < 4; y++)
+                {
+                    const uint8_t *row = src + std::min(by + y, height - 1) * width * channels;
+                    for (size_t x = 0; x < 4; x++)
+                    {
+                        const uint8_t *p = row + std::min(bx + x, width - 1) * channels;
+                        std::copy(p, p + 3, block + (y * 4 + x) * 3);
+                    }
+                }
+                encodeBlock(block, dst);
+                dst += 8;
+            }
+        }
+    }
+
+    /*
+        Encodes 16 RGB pixels into one BC1 block. The endpoints are the
+        extremes of the pixels along their principal axis, inset by 1/16
+        of the range, in four colour mode.
+    */
+    static void encodeBlock(const uint8_t *rgb, uint8_t *dst)
+    {
+        float mean[3] = {0.f, 0.f, 0.f};
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 3; c++)
+                mean[c] += rgb[i * 3 + c];
+        for (float &m : mean)
+            m /= 16.f;
+
+        float cov[6] = {0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
+        for (int i = 0; i < 16; i++)
+        {
+            float r = rgb[i * 3] - mean[0];
+            float g = rgb[i * 3 + 1] - mean[1];
+            float b = rgb[i * 3 + 2] - mean[2];
+            cov[0] += r * r;
+            cov[1] += r * g;
+            cov[2] += r * b;
+            cov[3] += g * g;
+            cov[4] += g * b;
+            cov[5] += b * b;
+        }
+
+        // Principal axis by power iteration, from the covariance row of the
+        // channel that varies most. Starting from grey would miss blocks
+        // varying at right angles to it, such as equally bright red and
+        // green interference colours.
+        float axis[3] = {cov[0], cov[1], cov[2]};
+        if (cov[3] > cov[0] && cov[3] >= cov[5])
+        {
+            axis[0] = cov[1];
+            axis[1] = cov[3];
+            axis[2] = cov[4];
+        }
+        else if (cov[5] > cov[0] && cov[5] > cov[3])
+        {
+            axis[0] = cov[2];
+            axis[1] = cov[4];
+            axis[2] = cov[5];
+        }
+        for (int iteration = 0; iteration < 4; iteration++)
+        {
+            float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+            float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+            float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+            float length = std::max({std::abs(x), std::abs(y), std::abs(z)});
+            if (length < 1e-6f)
+                break;
+            axis[0] = x / length;
+            axis[1] = y / length;
+            axis[2] = z / length;
+        }
+
+        float minT = std::numeric_limits<float>::max();
+        float maxT = std::numeric_limits<float>::lowest();
+        for (int i = 0; i < 16; i++)
+        {
+            float t = (rgb[i * 3] - mean[0]) * axis[0] + (rgb[i * 3 + 1] - mean[1]) * axis[1] + (rgb[i * 3 + 2] - mean[2]) * axis[2];
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+
+        float inset = (maxT - minT) / 16.f;
+        minT += inset;
+        maxT -= inset;
+
+        float axisLength = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        if (axisLength > 0.f)
+        {
+            minT /= axisLength;
+            maxT /= axisLength;
+        }
+
+        uint16_t color0 = pack565(mean[0] + axis[0] * maxT, mean[1] + axis[1] * maxT, mean[2] + axis[2] * maxT);
+        uint16_t color1 = pack565(mean[0] + axis[0] * minT, mean[1] + axis[1] * minT, mean[2] + axis[2] * minT);
+
+        // color0 > color1 selects the four colour mode; equal endpoints
+        // make a flat block
+        if (color0 < color1)
+            std::swap(color0, color1);
+
+        uint32_t indices = 0;
+        if (color0 != color1)
+        {
+            int palette[4][3];
+            unpack565(color0, palette[0]);
+            unpack565(color1, palette[1]);
+            for (int c = 0; c < 3; c++)
+            {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0;
+                int bestDistance = std::numeric_limits<int>::max();
+                for (int p = 0; p < 4; p++)
+                {
+                    int dr = rgb[i * 3] - palette[p][0];
+                    int dg = rgb[i * 3 + 1] - palette[p][1];
+                    int db = rgb[i * 3 + 2] - palette[p][2];
+                    int distance = dr * dr + dg * dg + db * db;
+                    if (distance < bestDistance)
+                    {
+                        best = p;
+                        bestDistance = distance;
+                    }
+                }
+                indices |= static_cast<uint32_t>(best) << (i * 2);
+            }
+        }
+
+        dst[0] = color0 & 0xff;
+        dst[1] = color0 >> 8;
+        dst[2] = color1 & 0xff;
+        dst[3] = color1 >> 8;
+        for (int i = 0; i < 4; i++)
+            dst[4 + i] = (indices >> (i * 8)) & 0xff;
+    }
+
+    // Encodes `pixels` and writes them to `path`, creating its folders
+    static bool write(const std::filesystem::path &path, const ofPixels &pixels)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(path.parent_path(), ec);
+
+        Header header{};
+        std::copy(std::begin(magic), std::end(magic), header.magic);
+        header.version = version;
+        header.width = static_cast<uint32_t>(pixels.getWidth());
+        header.height = static_cast<uint32_t>(pixels.getHeight());
+        header.dataBytes = static_cast<uint32_t>(dataBytes(header.width, header.height));
+
+        std::vector<uint8_t> blocks(header.dataBytes);
+        encode(pixels, blocks.data());
+
+        // Written under a temporary name, so a reader never sees half a file
+        std::filesystem::path partial = path;
+        partial += ".part";
+        {
+            std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+            out.write(reinterpret_cast<const char *>(blocks.data()), blocks.size());
+            if (!out)
+                return false;
+        }
+        std::filesystem::rename(partial, path, ec);
+        return !ec;
+    }
+
+    /*
+        Reads the blocks of `path` into the storage of `blocks`. A buffer
+        large enough keeps its shape, so the loader's pooled buffers take
+        decoded and compressed tiles alike without reallocating; a smaller
+        one becomes a single row of one byte pixels. False if there is no
+        valid sidecar.
+    */
+    static bool read(const std::filesystem::path &path, Header &header, ofPixels &blocks)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in || !in.read(reinterpret_cast<char *>(&header), sizeof(Header)) ||
+            !std::equal(std::begin(magic), std::end(magic), header.magic) ||
+            header.version != version ||
+            header.dataBytes != dataBytes(header.width, header.height))
+            return false;
+
+        if (blocks.getTotalBytes() < header.dataBytes)
+            blocks.allocate(header.dataBytes, 1, OF_PIXELS_GRAY);
+        return static_cast<bool>(in.read(reinterpret_cast<char *>(blocks.getData()), header.dataBytes));
+    }
+
+    // Allocates `texture` as a BC1 GL_TEXTURE_2D holding `blocks`
+    static void upload(const Header &header, const void *blocks, ofTexture &texture)
+    {
+        ofTextureData data;
+        data.textureTarget = GL_TEXTURE_2D;
+        data.glInternalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        data.width = header.width;
+        data.height = header.height;
+        data.tex_w = header.width;
+        data.tex_h = header.height;
+        data.tex_t = 1.f;
+        data.tex_u = 1.f;
+        texture.allocate(data, GL_RGB, GL_UNSIGNED_BYTE);
+
+        glBindTexture(GL_TEXTURE_2D, texture.getTextureData().textureID);
+        glCompressedTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, header.width, header.height, 0, header.dataBytes, blocks);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    static bool isCompressed(const ofTexture &texture)
+    {
+        return texture.isAllocated() && texture.getTextureData().glInternalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    }
+
+private:
+    static uint16_t pack565(float r, float g, float b)
+    {
+        auto quantize = [](float v, int max)
+        {
+            return static_cast<uint16_t>(std::lround(std::clamp(v, 0.f, 255.f) * max / 255.f));
+        };
+        return (quantize(r, 31) << 11) | (quantize(g, 63) << 5) | quantize(b, 31);
+    }
+
+    static void unpack565(uint16_t color, int *rgb)
+    {
+        int r = (color >> 11) & 31;
+        int g = (color >> 5) & 63;
+        int b = color & 31;
+        rgb[0] = (r << 3) | (r >> 2);
+        rgb[1] = (g << 2) | (g >> 4);
+        rgb[2] = (b << 3) | (b >> 2);
+    }
+};
@@ -0,0 +1,237 @@
+#pragma once
+
+#include "ofMain.h"
+#include "TileCompositor.hpp"
+
+#include <atomic>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <thread>
+
+/*
+    Exports the whole layout as a Deep Zoom image (`<name>.dzi` and the
+    `<name>_files/<level>/<column>_<row>.jpg` pyramid) that viewers such as
+    OpenSeadragon stream from disk.
+
+    The layout is composed in bands of one tile row at full resolution and
+    the pyramid is built as the bands come in: every level holds a single
+    row of tiles, writes it out once it is full and passes it on to the
+    level below at half the size. Memory stays at a few tile rows of the
+    full width however large the layout is. The tiles of a row are encoded
+    in parallel.
+*/
+class DeepZoomExporter
+{
+public:
+    // `tileSize` is rounded down to an even number
+    DeepZoomExporter(TileCompositor &compositor, int tileSize = 256, size_t numThreads = 0)
+        : compositor(compositor), tileSize(std::max(tileSize & ~1, 2))
+    {
+        if (numThreads == 0)
+            numThreads = std::thread::hardware_concurrency();
+        this->numThreads = std::max<size_t>(numThreads, 1);
+    }
+
+    // Writes the layout at `zoom` and `theta` to `path` (ending in .dzi)
+    bool exportLayout(const std::filesystem::path &path, Zoom zoom, Theta theta)
+    {
+        ofRectangle bounds = compositor.getLayoutBounds(zoom);
+        int x0 = static_cast<int>(std::floor(bounds.getLeft()));
+        int y0 = static_cast<int>(std::floor(bounds.getTop()));
+        int width = static_cast<int>(std::ceil(bounds.getRight())) - x0;
+        int height = static_cast<int>(std::ceil(bounds.getBottom())) - y0;
+        if (width <= 0 || height <= 0)
+            return false;
+
+        filesDir = path.parent_path() / (path.stem().string() + "_files");
+        std::error_code ec;
+        std::filesystem::remove_all(filesDir, ec);
+
+        // Level 0 is a single pixel, the last level full resolution
+        int maxLevel = static_cast<int>(std::ceil(std::log2(std::max(width, height))));
+        levels.assign(maxLevel + 1, {});
+        for (int i = maxLevel, w = width, h = height; i >= 0; i--, w = (w + 1) / 2, h = (h + 1) / 2)
+        {
+            Level &level = levels[i];
+            level.width = w;
+            level.height = h;
+            level.rows.allocate(w, tileSize, OF_PIXELS_RGB);
+            std::filesystem::create_directories(filesDir / std::to_string(i), ec);
+        }
+
+        rowsDone = 0;
+        rowsTotal = height;
+        failed = 0;
+
+        ofLogNotice("DeepZoomExporter") << "Exporting " << width << "x" << height << " in " << levels.size() << " levels to " << path;
+
+        compositor.setCarryOver(true);
+        ofPixels band;
+        for (int y = 0; y < height && !cancelled; y += tileSize)
+        {
+            int rows = std::min(tileSize, height - y);
+            if (!compositor.compose(ofRectangle(x0, y0 + y, width, rows), zoom, theta, band))
+                failed++;
+            push(maxLevel, band.getData(), rows);
+            rowsDone += rows;
+        }
+        compositor.setCarryOver(false);
+        levels.clear();
+
+        if (cancelled)
+            return false;
+
+        std::ofstream dzi(path);
+        dzi << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"jpg\" Overlap=\"0\" TileSize=\"" << tileSize << "\">\n"
+            << "  <Size Width=\"" << width << "\" Height=\"" << height << "\"/>\n"
+            << "</Image>\n";
+
+        return static_cast<bool>(dzi) && failed == 0;
+    }
+
+    // As TileCompositor::cancel(), also before exportLayout() has started
+    void cancel()
+    {
+        cancelled = true;
+        compositor.cancel();
+    }
+
+    size_t getRowsDone() const
+    {
+        return rowsDone;
+    }
+
+    size_t getRowsTotal() const
+    {
+        return rowsTotal;
+    }
+
+    // Halves `rows` rows of `src` (`width` pixels wide) with a 2x2 box
+    // filter. Odd last rows and columns are averaged with themselves.
+    static void downsample(const uint8_t *src, int width, int rows, uint8_t *dst)
+    {
+        int dstWidth = (width + 1) / 2;
+        size_t srcStride = static_cast<size_t>(width) * 3;
+        size_t dstStride = static_cast<size_t>(dstWidth) * 3;
+
+        for (int y = 0; y < (rows + 1) / 2; y++)
+        {
+            const uint8_t *top = src + 2 * y * srcStride;
+            const uint8_t *bottom = 2 * y + 1 < rows ? top + srcStride : top;
+            uint8_t *out = dst + y * dstStride;
+
+            for (int x = 0; x < width / 2; x++)
+            {
+                for (int c = 0; c < 3; c++)
+                    out[x * 3 + c] = static_cast<uint8_t>((top[x * 6 + c] + top[x * 6 + 3 + c] + bottom[x * 6 + c] + bottom[x * 6 + 3 + c] + 2) >> 2);
+            }
+
+            if (width % 2)
+            {
+                int x = width / 2;
+                for (int c = 0; c < 3; c++)
+                    out[x * 3 + c] = static_cast<uint8_t>((top[x * 6 + c] + bottom[x * 6 + c] + 1) >> 1);
+            }
+        }
+    }
+
+private:
+    struct Level
+    {
+        int width;
+        int height;
+        int rowsIn = 0;  // rows received so far
+        int filled = 0;  // rows in `rows`
+        int tileRow = 0; // next row of tiles to write
+        ofPixels rows;
+    };
+
+    // Appends `numRows` rows to the full resolution level
+    void push(int index, const uint8_t *data, int numRows)
+    {
+        Level &level = levels[index];
+        size_t stride = static_cast<size_t>(level.width) * 3;
+
+        while (numRows > 0)
+        {
+            int n = std::min(numRows, tileSize - level.filled);
+            std::memcpy(level.rows.getData() + level.filled * stride, data, n * stride);
+            level.filled += n;
+            level.rowsIn += n;
+            data += n * stride;
+            numRows -= n;
+
+            if (level.filled == tileSize || level.rowsIn == level.height)
+                flush(index);
+        }
+    }
+
+    void flush(int index)
+    {
+        Level &level = levels[index];
+        writeTiles(index);
+
+        // A tile row is half a tile row on the level below, so it always
+        // fits behind the rows that level already holds
+        if (index > 0)
+        {
+            Level &below = levels[index - 1];
+            int rows = (level.filled + 1) / 2;
+            downsample(level.rows.getData(), level.width, level.filled, below.rows.getData() + static_cast<size_t>(below.filled) * below.width * 3);
+            below.filled += rows;
+            below.rowsIn += rows;
+
+            if (below.filled == tileSize || below.rowsIn == below.height)
+                flush(index - 1);
+        }
+
+        level.filled = 0;
+        level.tileRow++;
+    }
+
+    void writeTiles(int index)
+    {
+        const Level &level = levels[index];
+        int columns = (level.width + tileSize - 1) / tileSize;
+        std::filesystem::path dir = filesDir / std::to_string(index);
+
+        std::atomic<int> next = 0;
+        auto work = [&]
+        {
+            ofPixels tile;
+            for (int column = next++; column < columns; column = next++)
+            {
+                int x = column * tileSize;
+                int w = std::min(tileSize, level.width - x);
+                tile.allocate(w, level.filled, OF_PIXELS_RGB);
+                for (int y = 0; y < level.filled; y++)
+                    std::memcpy(tile.getData() + y * w * 3, level.rows.getData() + (static_cast<size_t>(y) * level.width + x) * 3, w * 3);
+
+                std::filesystem::path tilePath = dir / std::format("{}_{}.jpg", column, level.tileRow);
+                if (!ofSaveImage(tile, tilePath, OF_IMAGE_QUALITY_HIGH))
+                    failed++;
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < std::min<size_t>(numThreads, columns); i++)
+            workers.emplace_back(work);
+        work();
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+
+    TileCompositor &compositor;
+    int tileSize;
+    size_t numThreads;
+
+    std::filesystem::path filesDir;
+    std::vector<Level> levels;
+
+    std::atomic<size_t> rowsDone = 0;
+    std::atomic<size_t> rowsTotal = 0;
+    std::atomic<bool> cancelled = false;
+    std::atomic<size_t> failed = 0;
+};
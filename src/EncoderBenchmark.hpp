@@ -0,0 +1,98 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxFFmpegRecorder.h"
+
+#include <chrono>
+#include <filesystem>
+#include <format>
+
+/*
+    Measures end-to-end recording throughput: frames go through
+    addSingleFrame() into the recorder exactly as they do from the render
+    loop, and the clock stops once stop() has returned, i.e. once ffmpeg has
+    written the last frame. Every backend and frame format that is built in
+    encodes the same synthetic frames with the settings ofApp records with.
+*/
+inline int runEncoderBenchmark(int width, int height, int numFrames)
+{
+    // A handful of distinct frames with gradients and noise, so the encoder
+    // has real work to do. Generating them is not part of the measurement.
+    std::vector<ofPixels> frames(8);
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        ofPixels &frame = frames[i];
+        frame.allocate(width, height, OF_PIXELS_RGB);
+        unsigned char *data = frame.getData();
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                unsigned char *p = data + (static_cast<size_t>(y) * width + x) * 3;
+                p[0] = static_cast<unsigned char>(x + i * 8);
+                p[1] = static_cast<unsigned char>(y + i * 4);
+                p[2] = static_cast<unsigned char>(ofRandom(64) + (x ^ y));
+            }
+        }
+    }
+
+    struct Variant
+    {
+        std::string name;
+        ofxFFmpegRecorder::Backend backend;
+        bool convertYuv;
+    };
+
+    std::vector<Variant> variants = {
+        {"pipe rgb24", ofxFFmpegRecorder::Backend::Pipe, false},
+        {"pipe yuv420p", ofxFFmpegRecorder::Backend::Pipe, true},
+    };
+    if (ofxFFmpegRecorder::isLibavAvailable())
+    {
+        variants.push_back({"libav rgb24", ofxFFmpegRecorder::Backend::Libav, false});
+        variants.push_back({"libav yuv420p", ofxFFmpegRecorder::Backend::Libav, true});
+    }
+
+    std::filesystem::path output = std::filesystem::temp_directory_path() / "thinsections_encoder_benchmark.mp4";
+
+    ofLogNotice() << "Encoder benchmark: " << numFrames << " frames of " << width << "x" << height;
+
+    float baseline = 0.f;
+    for (const Variant &variant : variants)
+    {
+        ofxFFmpegRecorder recorder;
+        recorder.setup(true, false, {width, height}, 30.f, 24000);
+        recorder.setBackend(variant.backend);
+        recorder.setConvertToYuv(variant.convertYuv);
+        recorder.setInputPixelFormat(OF_IMAGE_COLOR);
+        recorder.setOutputPath(output.string());
+        recorder.setOverWrite(true);
+        recorder.setVideoCodec("libx264");
+        recorder.addAdditionalInputArgument("-hide_banner");
+        recorder.addAdditionalInputArgument("-loglevel error");
+        recorder.addAdditionalOutputArgument("-crf 16");
+        recorder.addAdditionalOutputArgument("-preset slow");
+
+        if (!recorder.startCustomRecord())
+        {
+            ofLogError() << "Encoder benchmark: could not start " << variant.name;
+            return 1;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < numFrames; i++)
+            recorder.addSingleFrame(frames[i % frames.size()]);
+        recorder.stop();
+        float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+        float fps = numFrames / seconds;
+        if (baseline == 0.f)
+            baseline = fps;
+
+        ofLogNotice() << std::format(" - {:<14} {:7.2f} fps  {:5.2f}x", variant.name, fps, fps / baseline);
+    }
+
+    std::error_code ec;
+    std::filesystem::remove(output, ec);
+    return 0;
+}
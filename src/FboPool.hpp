@@ -0,0 +1,78 @@
+#pragma once
+
+#include "ofMain.h"
+
+/*
+    Window sized render targets of the fbo render path, shared by all
+    tilesets. A tileset holds a set only while it is on screen (see
+    ofApp::drawTiles), so video memory follows the number of visible
+    tilesets instead of the size of the layout. Released sets are kept
+    for reuse until the window size changes.
+*/
+class FboPool
+{
+public:
+    // The two theta levels of a tileset and their blend
+    struct Targets
+    {
+        ofFbo a;
+        ofFbo b;
+        ofFbo main;
+    };
+
+    void resize(int w, int h)
+    {
+        width = w;
+        height = h;
+        numAllocated -= free.size();
+        free.clear();
+    }
+
+    std::shared_ptr<Targets> acquire()
+    {
+        if (free.size())
+        {
+            std::shared_ptr<Targets> targets = std::move(free.back());
+            free.pop_back();
+            return targets;
+        }
+
+        auto targets = std::make_shared<Targets>();
+        targets->a.allocate(width, height, GL_RGBA);
+        targets->b.allocate(width, height, GL_RGBA);
+        targets->main.allocate(width, height, GL_RGBA);
+        numAllocated++;
+        return targets;
+    }
+
+    // Targets of an old window size are dropped. Every set acquired has to
+    // come back here, or size() counts it forever.
+    void release(std::shared_ptr<Targets> &targets)
+    {
+        if (!targets)
+            return;
+
+        if (targets->main.getWidth() == width && targets->main.getHeight() == height)
+            free.push_back(std::move(targets));
+        else
+            numAllocated--;
+        targets.reset();
+    }
+
+    size_t numFree() const
+    {
+        return free.size();
+    }
+
+    // Sets in use and free
+    size_t size() const
+    {
+        return numAllocated;
+    }
+
+private:
+    int width = 0;
+    int height = 0;
+    size_t numAllocated = 0;
+    std::vector<std::shared_ptr<Targets>> free;
+};
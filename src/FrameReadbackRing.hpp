@@ -0,0 +1,158 @@
+#pragma once
+
+#include "ofMain.h"
+
+/*
+    Reads rendered frames back from an FBO through a ring of pixel pack
+    buffers. read() only queues the copy on the GPU and places a fence
+    behind it; collect() hands over the frames whose fence has signalled,
+    oldest first. Frame N is then transferred while frame N+1 renders
+    instead of stalling the main thread on every frame.
+*/
+class FrameReadbackRing
+{
+public:
+    FrameReadbackRing(size_t numBuffers = 3) : slots(numBuffers) {}
+
+    ~FrameReadbackRing()
+    {
+        for (Slot &slot : slots)
+            if (slot.fence != nullptr)
+                glDeleteSync(slot.fence);
+    }
+
+    // Queues a copy of the first color attachment of `fbo`. If the ring is
+    // full, the oldest frame is waited for and passed to `consumer` first.
+    template <typename Consumer>
+    void read(ofFbo &fbo, Consumer &&consumer)
+    {
+        Slot &slot = slots[head];
+        if (slot.fence != nullptr)
+            collectOne(slot, true, consumer);
+
+        int glFormat = ofGetGLFormatFromInternal(fbo.getTexture().getTextureData().glInternalFormat);
+        size_t channels = ofGetNumChannelsFromGLFormat(glFormat);
+        int width = static_cast<int>(fbo.getWidth());
+        int height = static_cast<int>(fbo.getHeight());
+        size_t bytes = static_cast<size_t>(width) * height * channels;
+
+        if (slot.bytes < bytes)
+        {
+            slot.buffer.allocate(bytes, GL_STREAM_READ);
+            slot.bytes = bytes;
+        }
+        slot.width = width;
+        slot.height = height;
+        slot.channels = channels;
+
+        fbo.bind();
+        slot.buffer.bind(GL_PIXEL_PACK_BUFFER);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, glFormat, GL_UNSIGNED_BYTE, nullptr);
+        slot.buffer.unbind(GL_PIXEL_PACK_BUFFER);
+        fbo.unbind();
+
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.issued = ofGetElapsedTimeMicros();
+
+        head = (head + 1) % slots.size();
+        pending++;
+    }
+
+    // Passes every finished frame to `consumer` in the order they were read
+    template <typename Consumer>
+    void collect(Consumer &&consumer)
+    {
+        while (pending && collectOne(slots[tail()], false, consumer))
+            ;
+    }
+
+    // Waits for and passes on all outstanding frames
+    template <typename Consumer>
+    void flush(Consumer &&consumer)
+    {
+        while (pending)
+            collectOne(slots[tail()], true, consumer);
+    }
+
+    size_t numPending() const
+    {
+        return pending;
+    }
+
+    // Time from read() until the frame was handed over (moving average)
+    float getLatencyMs() const
+    {
+        return latencyMs;
+    }
+
+private:
+    struct Slot
+    {
+        ofBufferObject buffer;
+        size_t bytes = 0;
+        int width = 0;
+        int height = 0;
+        size_t channels = 0;
+        GLsync fence = nullptr;
+        uint64_t issued = 0;
+    };
+
+    size_t tail() const
+    {
+        return (head + slots.size() - pending) % slots.size();
+    }
+
+    template <typename Consumer>
+    bool collectOne(Slot &slot, bool wait, Consumer &consumer)
+    {
+        GLenum status;
+        if (wait)
+        {
+            do
+                status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            while (status == GL_TIMEOUT_EXPIRED);
+        }
+        else
+            status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+
+        if (status == GL_TIMEOUT_EXPIRED)
+            return false;
+
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+        pending--;
+
+        if (status == GL_WAIT_FAILED)
+        {
+            ofLogError() << "FrameReadbackRing: waiting for a frame failed, frame dropped";
+            return true;
+        }
+
+        size_t bytes = static_cast<size_t>(slot.width) * slot.height * slot.channels;
+        pixels.allocate(slot.width, slot.height, slot.channels);
+
+        const void *src = slot.buffer.mapRange(0, bytes, GL_MAP_READ_BIT);
+        if (src == nullptr)
+        {
+            ofLogError() << "FrameReadbackRing: could not map frame, frame dropped";
+            return true;
+        }
+        std::memcpy(pixels.getData(), src, bytes);
+        slot.buffer.unmap();
+
+        float latency = (ofGetElapsedTimeMicros() - slot.issued) / 1000.f;
+        latencyMs = ofLerp(latencyMs, latency, 0.05f);
+
+        consumer(pixels);
+        return true;
+    }
+
+    std::vector<Slot> slots;
+    size_t head = 0;
+    size_t pending = 0;
+    float latencyMs = 0.f;
+
+    // Reused for every frame handed to the consumer
+    ofPixels pixels;
+};
@@ -0,0 +1,307 @@
+#pragma once
+
+#include "ofMain.h"
+#include "TileKey.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+/*
+    Writes the path the camera traces during a recording on a thread of its
+    own. The render loop only appends a Record to a preallocated buffer;
+    formatting and file I/O happen in blocks of `blockRows` records.
+
+    `<name>_path.csv` has the same columns as before. With `binary` set,
+    `<name>_path.bin` is written next to it for tools that load millions of
+    rows: a Header, one ColumnInfo per column, the tileset names (each a
+    uint16 length and the characters), then blocks of a uint32 row count,
+    four reserved bytes and every column's values of those rows back to back.
+    The dtypes are numpy's, so a block's columns can be read with
+    numpy.frombuffer directly.
+*/
+class PathTraceWriter
+{
+public:
+    static constexpr char magic[8] = {'T', 'S', 'C', 'T', 'R', 'A', 'C', 'E'};
+    static constexpr uint32_t version = 1;
+    static constexpr size_t blockRows = 4096;
+    static constexpr TilesetId noTileset = std::numeric_limits<TilesetId>::max();
+
+    struct Record
+    {
+        float t;
+        int32_t frame;
+        float x;
+        float y;
+        float leftX;
+        float leftY;
+        float rightX;
+        float rightY;
+        float theta;
+        float zoomLevel;
+        float rotation;
+        TilesetId currentTileset;
+        TilesetId nextTileset;
+        int32_t poi;
+        float distance;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerBytes; // up to the first block
+        uint32_t numColumns;
+        uint32_t numTilesets;
+    };
+
+    struct ColumnInfo
+    {
+        char name[16];
+        char dtype[4];
+    };
+
+    PathTraceWriter() = default;
+    PathTraceWriter(const PathTraceWriter &) = delete;
+    PathTraceWriter &operator=(const PathTraceWriter &) = delete;
+
+    ~PathTraceWriter()
+    {
+        close();
+    }
+
+    /*
+        Starts `<dir>/<name>_path.csv` (and `.bin`). `tilesetNames` are
+        indexed by the TilesetIds of the records.
+    */
+    bool open(const std::filesystem::path &dir, const std::string &name, const std::vector<std::string> &tilesetNames, bool binary)
+    {
+        close();
+
+        names = tilesetNames;
+        numRows = 0;
+
+        csv.open(dir / (name + "_path.csv"), std::ios::trunc);
+        if (!csv)
+        {
+            ofLogError("PathTraceWriter") << "Cannot open " << dir / (name + "_path.csv");
+            return false;
+        }
+        csv << "t,frame,x,y,leftX,leftY,rightX,rightY,theta,zoomLevel,rotation,currentTileset,nextTileset,poi,distance\n";
+
+        if (binary)
+        {
+            bin.open(dir / (name + "_path.bin"), std::ios::binary | std::ios::trunc);
+            writeBinaryHeader();
+        }
+
+        pending.reserve(blockRows * 2);
+        writing.reserve(blockRows * 2);
+        text.reserve(blockRows * 160);
+
+        closed = false;
+        thread = std::thread([this]
+                             { run(); });
+        return true;
+    }
+
+    void add(const Record &record)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed)
+            return;
+
+        pending.push_back(record);
+        if (pending.size() >= blockRows)
+            condition.notify_one();
+    }
+
+    // Writes what is left and closes the files
+    void close()
+    {
+        if (!thread.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        condition.notify_one();
+        thread.join();
+
+        csv.close();
+        if (bin.is_open())
+            bin.close();
+
+        ofLogNotice("PathTraceWriter") << "Wrote " << numRows << " rows";
+    }
+
+    bool isOpen() const
+    {
+        return thread.joinable();
+    }
+
+    /*
+        Appends the binary traces of `parts` into `output`. The parts must
+        have been written with the same tileset names, as the parts of a
+        segmented render are.
+    */
+    static bool join(const std::vector<std::filesystem::path> &parts, const std::filesystem::path &output)
+    {
+        std::ofstream out(output, std::ios::binary | std::ios::trunc);
+        for (size_t i = 0; i < parts.size(); i++)
+        {
+            std::ifstream in(parts[i], std::ios::binary);
+            Header header;
+            if (!in.read(reinterpret_cast<char *>(&header), sizeof(Header)) ||
+                !std::equal(std::begin(magic), std::end(magic), header.magic) ||
+                header.version != version)
+                return false;
+
+            // Only the first part's header is kept
+            in.seekg(i == 0 ? 0 : header.headerBytes);
+            out << in.rdbuf();
+        }
+        return static_cast<bool>(out);
+    }
+
+private:
+    struct Column
+    {
+        const char *name;
+        const char *dtype;
+        size_t offset;
+        size_t size;
+    };
+
+#define PATH_TRACE_COLUMN(member, dtype) {#member, dtype, offsetof(Record, member), sizeof(Record::member)}
+    static constexpr Column columns[] = {
+        PATH_TRACE_COLUMN(t, "<f4"),
+        PATH_TRACE_COLUMN(frame, "<i4"),
+        PATH_TRACE_COLUMN(x, "<f4"),
+        PATH_TRACE_COLUMN(y, "<f4"),
+        PATH_TRACE_COLUMN(leftX, "<f4"),
+        PATH_TRACE_COLUMN(leftY, "<f4"),
+        PATH_TRACE_COLUMN(rightX, "<f4"),
+        PATH_TRACE_COLUMN(rightY, "<f4"),
+        PATH_TRACE_COLUMN(theta, "<f4"),
+        PATH_TRACE_COLUMN(zoomLevel, "<f4"),
+        PATH_TRACE_COLUMN(rotation, "<f4"),
+        PATH_TRACE_COLUMN(currentTileset, "<u2"),
+        PATH_TRACE_COLUMN(nextTileset, "<u2"),
+        PATH_TRACE_COLUMN(poi, "<i4"),
+        PATH_TRACE_COLUMN(distance, "<f4"),
+    };
+#undef PATH_TRACE_COLUMN
+
+    void run()
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]
+                               { return closed || pending.size() >= blockRows; });
+                if (pending.empty())
+                    return;
+                std::swap(pending, writing);
+            }
+
+            writeCsv(writing);
+            if (bin.is_open())
+                writeBinary(writing);
+
+            numRows += writing.size();
+            writing.clear();
+        }
+    }
+
+    const std::string &tilesetName(TilesetId id) const
+    {
+        static const std::string none;
+        return id < names.size() ? names[id] : none;
+    }
+
+    void writeCsv(const std::vector<Record> &records)
+    {
+        text.clear();
+        auto out = std::back_inserter(text);
+        for (const Record &r : records)
+        {
+            std::format_to(out, "{},{},{},{},{},{},{},{},{},{},{},{},{},{},{}\n",
+                           r.t, r.frame, r.x, r.y, r.leftX, r.leftY, r.rightX, r.rightY, r.theta, r.zoomLevel, r.rotation,
+                           tilesetName(r.currentTileset), tilesetName(r.nextTileset), r.poi, r.distance);
+        }
+        csv.write(text.data(), text.size());
+        csv.flush();
+    }
+
+    void writeBinaryHeader()
+    {
+        uint32_t namesBytes = 0;
+        for (const std::string &name : names)
+            namesBytes += sizeof(uint16_t) + static_cast<uint32_t>(name.size());
+
+        Header header{};
+        std::copy(std::begin(magic), std::end(magic), header.magic);
+        header.version = version;
+        header.numColumns = static_cast<uint32_t>(std::size(columns));
+        header.numTilesets = static_cast<uint32_t>(names.size());
+        header.headerBytes = sizeof(Header) + header.numColumns * sizeof(ColumnInfo) + namesBytes;
+        bin.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+
+        for (const Column &column : columns)
+        {
+            ColumnInfo info{};
+            std::strncpy(info.name, column.name, sizeof(info.name) - 1);
+            std::strncpy(info.dtype, column.dtype, sizeof(info.dtype) - 1);
+            bin.write(reinterpret_cast<const char *>(&info), sizeof(ColumnInfo));
+        }
+
+        for (const std::string &name : names)
+        {
+            uint16_t length = static_cast<uint16_t>(name.size());
+            bin.write(reinterpret_cast<const char *>(&length), sizeof(length));
+            bin.write(name.data(), length);
+        }
+    }
+
+    void writeBinary(const std::vector<Record> &records)
+    {
+        uint32_t blockHeader[2] = {static_cast<uint32_t>(records.size()), 0};
+        bin.write(reinterpret_cast<const char *>(blockHeader), sizeof(blockHeader));
+
+        for (const Column &column : columns)
+        {
+            text.resize(records.size() * column.size);
+            char *dst = text.data();
+            for (const Record &r : records)
+            {
+                std::memcpy(dst, reinterpret_cast<const char *>(&r) + column.offset, column.size);
+                dst += column.size;
+            }
+            bin.write(text.data(), text.size());
+        }
+        bin.flush();
+    }
+
+    std::vector<std::string> names;
+    std::ofstream csv;
+    std::ofstream bin;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool closed = true;
+
+    std::vector<Record> pending;
+    std::vector<Record> writing;
+    std::string text;
+    size_t numRows = 0;
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "ofMain.h"
+#include <condition_variable>
+#include <mutex>
+
+/*
+    Fixed set of reusable pixel buffers shared between the decode workers and
+    the upload stage. A handle is owned by exactly one thread between
+    acquire() and release(), so the buffer itself is accessed without a
+    lock. Storage is only reallocated when a tile of a different size or
+    format is decoded into a buffer.
+*/
+class PixelBufferPool
+{
+public:
+    using Handle = size_t;
+
+    void setup(size_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        buffers.resize(capacity);
+        freeList.clear();
+        freeList.reserve(capacity);
+        for (Handle i = 0; i < capacity; i++)
+            freeList.push_back(i);
+    }
+
+    // Blocks until a buffer is free. Returns false once the pool is closed.
+    bool acquire(Handle &handle)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]
+                       { return closed || freeList.size(); });
+
+        if (closed)
+            return false;
+
+        handle = freeList.back();
+        freeList.pop_back();
+        return true;
+    }
+
+    void release(Handle handle)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            freeList.push_back(handle);
+        }
+        condition.notify_one();
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        condition.notify_all();
+    }
+
+    ofPixels &operator[](Handle handle)
+    {
+        return buffers[handle];
+    }
+
+    size_t capacity() const
+    {
+        return buffers.size();
+    }
+
+    size_t numFree()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return freeList.size();
+    }
+
+private:
+    std::vector<ofPixels> buffers;
+    std::vector<Handle> freeList;
+    bool closed = false;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "ofMain.h"
+
+/*
+    Streams decoded pixels into textures through a ring of pixel unpack
+    buffers. The copy into a mapped buffer is the only work done on the
+    main thread; the transfer into the texture happens asynchronously on the
+    GPU while the next buffers in the ring are being filled.
+*/
+class PixelUploadRing
+{
+public:
+    PixelUploadRing(size_t numBuffers = 8) : buffers(numBuffers), sizes(numBuffers, 0) {}
+
+    void upload(const ofPixels &pixels, ofTexture &texture)
+    {
+        size_t bytes = pixels.getTotalBytes();
+
+        ofBufferObject &buffer = buffers[next];
+        if (sizes[next] < bytes)
+        {
+            buffer.allocate(bytes, GL_STREAM_DRAW);
+            sizes[next] = bytes;
+        }
+
+        // Invalidating lets the driver hand back fresh storage instead of
+        // waiting for a previous transfer out of this buffer to finish
+        void *dst = buffer.mapRange(0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (dst == nullptr)
+        {
+            texture.loadData(pixels);
+            return;
+        }
+        std::memcpy(dst, pixels.getData(), bytes);
+        buffer.unmap();
+
+        if (!texture.isAllocated() ||
+            texture.getWidth() != pixels.getWidth() ||
+            texture.getHeight() != pixels.getHeight())
+            texture.allocate(pixels.getWidth(), pixels.getHeight(), ofGetGLInternalFormat(pixels));
+
+        texture.loadData(buffer, ofGetGLFormat(pixels), ofGetGLType(pixels));
+
+        next = (next + 1) % buffers.size();
+    }
+
+private:
+    std::vector<ofBufferObject> buffers;
+    std::vector<size_t> sizes;
+    size_t next = 0;
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "ofMain.h"
+#include "PathTraceWriter.hpp"
+
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <future>
+
+/*
+    Splits an offline render into parts that run as separate processes and
+    joins their outputs afterwards.
+
+    Every part is a `--render <project> --frames <first>:<end>` run of the
+    same executable. It replays the sequence from the start without drawing
+    until `first` (the simulation runs at a fixed step and never waits on
+    tiles, so its state there is exactly that of a full render), then
+    records up to `end`. The parts are encoded with identical settings, so
+    their videos are joined with ffmpeg's concat demuxer without
+    re-encoding. Their path traces (CSV and binary) are appended into one.
+*/
+class SegmentedRender
+{
+public:
+    struct Part
+    {
+        int firstFrame;
+        int endFrame;
+        std::string name;
+    };
+
+    SegmentedRender(const std::filesystem::path &dir, const std::string &name, int numFrames, int numParts)
+        : dir(dir), name(name)
+    {
+        numParts = std::clamp(numParts, 1, std::max(numFrames, 1));
+        for (int i = 0; i < numParts; i++)
+        {
+            Part part;
+            part.firstFrame = static_cast<int>(static_cast<int64_t>(numFrames) * i / numParts);
+            part.endFrame = static_cast<int>(static_cast<int64_t>(numFrames) * (i + 1) / numParts);
+            part.name = std::format("{}_part{:02}", name, i);
+            parts.push_back(part);
+        }
+    }
+
+    // Command line rendering `part`, also usable on another machine that
+    // sees the same project folder
+    std::string command(const std::string &executable, const std::string &project, const Part &part) const
+    {
+        return std::format("\"{}\" --render \"{}\" --frames {}:{} --output \"{}\"",
+                           executable, project, part.firstFrame, part.endFrame, part.name);
+    }
+
+    // Runs all parts at once and waits for them. Fails if any part did.
+    bool render(const std::string &executable, const std::string &project) const
+    {
+        std::vector<std::future<int>> results;
+        for (const Part &part : parts)
+        {
+            std::string cmd = command(executable, project, part);
+            ofLogNotice("SegmentedRender") << cmd;
+            results.push_back(std::async(std::launch::async, [cmd]
+                                         { return std::system(cmd.c_str()); }));
+        }
+
+        bool ok = true;
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            int status = results[i].get();
+            if (status != 0)
+            {
+                ofLogError("SegmentedRender") << parts[i].name << " failed with status " << status;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    // Concatenates the parts into `<name>.mp4` and `<name>_path.csv`, takes
+    // the last part's end state and removes the part files
+    bool join(const std::string &ffmpegPath) const
+    {
+        std::filesystem::path listPath = dir / (name + "_parts.txt");
+        {
+            std::ofstream list(listPath);
+            for (const Part &part : parts)
+                list << "file '" << (dir / (part.name + ".mp4")).string() << "'\n";
+        }
+
+        std::filesystem::path videoPath = dir / (name + ".mp4");
+        std::string cmd = std::format("\"{}\" -hide_banner -loglevel error -y -f concat -safe 0 -i \"{}\" -c copy \"{}\"",
+                                      ffmpegPath, listPath.string(), videoPath.string());
+        ofLogNotice("SegmentedRender") << cmd;
+        if (std::system(cmd.c_str()) != 0)
+        {
+            ofLogError("SegmentedRender") << "Joining the parts failed, they are kept in " << dir;
+            return false;
+        }
+
+        std::ofstream trace(dir / (name + "_path.csv"));
+        for (size_t i = 0; i < parts.size(); i++)
+        {
+            std::ifstream partTrace(dir / (parts[i].name + "_path.csv"));
+            std::string line;
+
+            // Only the first part's header is kept
+            if (i > 0)
+                std::getline(partTrace, line);
+
+            while (std::getline(partTrace, line))
+                trace << line << '\n';
+        }
+
+        std::error_code ec;
+        if (std::filesystem::exists(dir / (parts.front().name + "_path.bin")))
+        {
+            std::vector<std::filesystem::path> partTraces;
+            for (const Part &part : parts)
+                partTraces.push_back(dir / (part.name + "_path.bin"));
+            if (!PathTraceWriter::join(partTraces, dir / (name + "_path.bin")))
+                ofLogWarning("SegmentedRender") << "Could not join the binary path traces";
+        }
+
+        std::filesystem::copy_file(dir / (parts.back().name + "_endstate.json"), dir / (name + "_endstate.json"),
+                                   std::filesystem::copy_options::overwrite_existing, ec);
+
+        std::filesystem::remove(listPath, ec);
+        for (const Part &part : parts)
+        {
+            for (const std::string &suffix : {".mp4", "_path.csv", "_path.bin", "_endstate.json"})
+                std::filesystem::remove(dir / (part.name + suffix), ec);
+        }
+
+        return true;
+    }
+
+    const std::vector<Part> &getParts() const
+    {
+        return parts;
+    }
+
+private:
+    std::filesystem::path dir;
+    std::string name;
+    std::vector<Part> parts;
+};
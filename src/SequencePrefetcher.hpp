@@ -0,0 +1,315 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Sequencer.hpp"
+#include "SmoothValue.h"
+#include "TilesetManager.hpp"
+
+/*
+    Predicts where the camera will be over the next few seconds of a
+    sequence, so the tiles it needs can be loaded before it gets there.
+
+    The sequence is walked ahead of the render clock with simplified
+    versions of the camera moves in ofApp (eased flights to POIs and
+    overviews, drills, waits and theta cycling). The zoom is stepped
+    through a SmoothValueLinear set up as ofApp::currentZoomSmooth, at the
+    simulation's frame rate. The result is a list of
+    keyframes. Positions are in full resolution scan pixels (world
+    coordinates times the current zoom), so they do not depend on the
+    zoom level the app is at. Rotation is not predicted; callers cover
+    the circle around the screen instead.
+*/
+class SequencePrefetcher : public Visitor
+{
+public:
+    struct CameraState
+    {
+        ofVec2f center;
+        float zoom;
+        float theta;
+        float zoomTarget;
+        float zoomElapsed; // seconds since zoomTarget was set
+    };
+
+    struct Keyframe
+    {
+        float time;
+        ofVec2f center;
+        float zoom;
+        float theta;
+    };
+
+    struct Parameters
+    {
+        float flyHeight;
+        float drillTime;
+        float thetaSpeed; // per frame, as in ofApp
+        float minMovingTime;
+        float maxMovingTime;
+        float zoomAdjust;
+        float zoomSpeed;
+        float zoomWarmUp; // of the flights, as ofApp::setViewTarget()
+        float zoomMaxStep;
+        float fps;
+        bool cycleTheta;
+    };
+
+    SequencePrefetcher(TilesetManager &tilesets) : tilesetManager(tilesets) {}
+
+    /*
+        Walks `sequence` from `step`, which started `stepElapsed` seconds
+        ago, until `horizon` seconds from now. Keyframes are sampled every
+        `sampleInterval` seconds and are ordered by time.
+    */
+    const std::vector<Keyframe> &predict(
+        const std::vector<std::shared_ptr<SequenceEvent>> &sequence,
+        size_t step,
+        float stepElapsed,
+        const CameraState &start,
+        const Parameters &params,
+        Zoom currentZoom,
+        float horizon)
+    {
+        keyframes.clear();
+        state = start;
+        parameters = params;
+        zoom = currentZoom;
+        end = horizon;
+        now = 0.f;
+        elapsed = stepElapsed;
+        stopped = false;
+
+        zoomSmooth.speed = parameters.zoomSpeed;
+        zoomSmooth.maxStep = parameters.zoomMaxStep;
+        zoomSmooth.warmUp = parameters.zoomWarmUp;
+        zoomSmooth.jumpTo(start.zoom);
+        zoomSmooth.setTarget(start.zoomTarget);
+        zoomSmooth.setElapsedTime(start.zoomElapsed);
+
+        keyframes.push_back({0.f, state.center, state.zoom, state.theta});
+
+        for (size_t i = step; i < sequence.size() && !stopped && now < end; i++)
+            sequence[i]->accept(*this);
+
+        // Whatever comes after the last predicted step is unknown, the
+        // camera is assumed to stay where it is
+        if (!stopped && now < end)
+            hold(end - now);
+
+        return keyframes;
+    }
+
+    void visit(POI &ev) override
+    {
+        if (!tilesetManager.contains(ev.tileset))
+        {
+            stopped = true;
+            return;
+        }
+
+        std::shared_ptr<TileSet> tileset = tilesetManager[ev.tileset];
+        if (ev.poi >= tileset->viewTargets.size())
+        {
+            stopped = true;
+            return;
+        }
+
+        flyTo(*tileset, tileset->viewTargets[ev.poi], parameters.flyHeight, 1.f);
+    }
+
+    void visit(ParameterChange &ev) override
+    {
+        consumeElapsed(0.f);
+
+        if (ev.parameter == "flyHeight")
+            parameters.flyHeight = ev.value;
+        else if (ev.parameter == "drillTime")
+            parameters.drillTime = ev.value;
+        else if (ev.parameter == "thetaSpeed")
+            parameters.thetaSpeed = ev.value;
+        else if (ev.parameter == "minMovingTime")
+            parameters.minMovingTime = ev.value;
+        else if (ev.parameter == "maxMovingTime")
+            parameters.maxMovingTime = ev.value;
+        else if (ev.parameter == "zoomSpeed")
+            zoomSmooth.speed = parameters.zoomSpeed = ev.value;
+    }
+
+    void visit(WaitSeconds &ev) override
+    {
+        hold(ev.value);
+    }
+
+    void visit(WaitTheta &ev) override
+    {
+        float rate = thetaRate();
+        if (rate <= 0.f)
+        {
+            stopped = true;
+            return;
+        }
+
+        float remaining = std::fmodf(ev.value - state.theta + 360.f, 180.f);
+        hold(remaining / rate);
+    }
+
+    void visit(Drill &ev) override
+    {
+        float duration = consumeElapsed(parameters.drillTime);
+        float zoomFrom = state.zoom;
+        float zoomTo = ev.value - parameters.zoomAdjust;
+
+        advance(duration, [&](float u)
+                {
+                    // EASE_OUT, as drillZoomAnim
+                    float eased = 1.f - (1.f - u) * (1.f - u);
+                    state.zoom = ofLerp(zoomFrom, zoomTo, eased);
+                    zoomSmooth.jumpTo(state.zoom); });
+    }
+
+    void visit(Overview &ev) override
+    {
+        if (!tilesetManager.contains(ev.tileset))
+        {
+            stopped = true;
+            return;
+        }
+
+        flyTo(*tilesetManager[ev.tileset], {0.5f, 0.5f}, ev.value, 0.5f);
+    }
+
+    void visit(Jump &ev) override
+    {
+        consumeElapsed(0.f);
+
+        if (ev.state == "theta")
+            state.theta = ev.value;
+        else if (ev.state == "zoom")
+        {
+            zoomSmooth.jumpTo(ev.value - parameters.zoomAdjust);
+            state.zoom = zoomSmooth.getValue();
+        }
+
+        keyframes.push_back({now, state.center, state.zoom, state.theta});
+    }
+
+    void visit(Load &ev) override
+    {
+        // The loaded state is not known ahead of time
+        stopped = true;
+    }
+
+    void visit(End &ev) override
+    {
+        stopped = true;
+    }
+
+    float sampleInterval = 0.5f;
+
+private:
+    // Degrees of theta per second while cycling
+    float thetaRate() const
+    {
+        return parameters.cycleTheta ? parameters.thetaSpeed * parameters.fps : 0.f;
+    }
+
+    // The step in progress has already run for `elapsed` seconds
+    float consumeElapsed(float duration)
+    {
+        float remaining = std::max(duration - elapsed, 0.f);
+        elapsed = 0.f;
+        return remaining;
+    }
+
+    ofVec2f toReference(const TileSet &tileset, const ofVec2f &global) const
+    {
+        return (global * tileset.zoomWorldSizes.at(zoom) + tileset.offset) * zoom;
+    }
+
+    ofVec2f toGlobal(const TileSet &tileset, const ofVec2f &reference) const
+    {
+        return (reference / zoom - tileset.offset) / tileset.zoomWorldSizes.at(zoom);
+    }
+
+    // Mirrors ofApp::setViewTarget(): an eased flight whose duration grows
+    // with the distance, while zooming out towards `height`
+    void flyTo(const TileSet &tileset, const ofVec2f &global, float height, float delay)
+    {
+        ofVec2f from = state.center;
+        ofVec2f to = toReference(tileset, global);
+
+        float dist = toGlobal(tileset, from).distance(global) / sqrtf(2);
+        float movementTime = std::max(parameters.minMovingTime, parameters.maxMovingTime * dist);
+
+        float total = delay + movementTime;
+        float remaining = consumeElapsed(total);
+        float startU = total > 0.f ? 1.f - remaining / total : 1.f;
+
+        // A flight under way set the zoom target when it started
+        zoomSmooth.warmUp = parameters.zoomWarmUp;
+        zoomSmooth.setTarget(height - parameters.zoomAdjust, remaining >= total);
+
+        // EASE_IN_EASE_OUT, as viewTargetAnim
+        auto ease = [&](float t)
+        {
+            float flight = std::clamp((t - delay) / movementTime, 0.f, 1.f);
+            return flight * flight * (3.f - 2.f * flight);
+        };
+
+        // A flight already under way continues from where the camera is now
+        float easedStart = ease(startU * total);
+
+        advance(remaining, [&](float u)
+                {
+                    float eased = ease(ofLerp(startU, 1.f, u) * total);
+                    float progress = easedStart < 1.f ? (eased - easedStart) / (1.f - easedStart) : 1.f;
+                    state.center = from.getInterpolated(to, progress); });
+    }
+
+    void hold(float duration)
+    {
+        duration = consumeElapsed(duration);
+        advance(duration, [](float) {});
+    }
+
+    // Moves the clock forward by `duration`, calling `update(u)` with the
+    // fraction done at every sample. The zoom keeps approaching its target
+    // one simulation step at a time in between.
+    template <typename Update>
+    void advance(float duration, Update &&update)
+    {
+        float start = now;
+        float thetaStart = state.theta;
+        int samples = std::max(1, static_cast<int>(std::ceil(duration / sampleInterval)));
+        float dt = 1.f / std::max(parameters.fps, 1.f);
+        int steps = 0;
+
+        for (int i = 1; i <= samples; i++)
+        {
+            float u = static_cast<float>(i) / samples;
+            now = start + duration * u;
+            for (; (steps + 1) * dt <= duration * u; steps++)
+                zoomSmooth.process(dt);
+            state.zoom = zoomSmooth.getValue();
+            update(u);
+            state.theta = thetaStart + thetaRate() * duration * u;
+
+            if (now > end)
+                break;
+
+            keyframes.push_back({now, state.center, state.zoom, state.theta});
+        }
+    }
+
+    TilesetManager &tilesetManager;
+    std::vector<Keyframe> keyframes;
+    CameraState state;
+    Parameters parameters;
+    // Range as ofApp::currentZoomSmooth
+    SmoothValueLinear zoomSmooth = {4.f, 0.f, -10.f, 8.f};
+    Zoom zoom = 1;
+    float now = 0.f;
+    float end = 0.f;
+    float elapsed = 0.f;
+    bool stopped = false;
+};
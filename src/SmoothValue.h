@@ -1,3 +1,4 @@
+#pragma once
 
 #include <math.h>
 #include "ofMain.h"
@@ -58,6 +59,17 @@ public:
         return targetValue;
     }
 
+    // Seconds since the target was last set, which drives the warm up
+    float getElapsedTime() const
+    {
+        return elapsedTime;
+    }
+
+    void setElapsedTime(float seconds)
+    {
+        elapsedTime = seconds;
+    }
+
     bool process(float deltaS)
     {
         if (!needsProcessing || deltaS < 0.0001f)
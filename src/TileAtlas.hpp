@@ -0,0 +1,269 @@
+#pragma once
+
+#include "ofMain.h"
+#include "CompressedTile.hpp"
+#include "TileCacheLRU.hpp"
+
+#include <functional>
+#include <list>
+#include <unordered_map>
+
+/*
+    Copies of resident tiles in the layers of one GL_TEXTURE_2D_ARRAY, so
+    any number of tiles can be sampled by a single draw call. Every layer is
+    a slot the size of the largest tile; smaller tiles sit in the top left
+    corner of theirs. Tiles are copied in on the GPU with a framebuffer blit
+    the first time they are drawn and keep their slot until it is the least
+    recently used one and needed for another tile. Decoded pixels can be
+    uploaded into a slot directly, as VirtualTexture does with its pages.
+*/
+class TileAtlas
+{
+public:
+    TileAtlas() = default;
+    TileAtlas(const TileAtlas &) = delete;
+    TileAtlas &operator=(const TileAtlas &) = delete;
+
+    ~TileAtlas()
+    {
+        clear();
+    }
+
+    // As many slots as fit in `maxBytes`, up to the driver's layer limit
+    void allocate(int width, int height, size_t maxBytes)
+    {
+        clear();
+
+        GLint maxLayers = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        // RGBA, as drivers store RGB8 with four bytes a texel anyway
+        size_t slotBytes = static_cast<size_t>(width) * height * 4;
+        numSlots = static_cast<int>(std::min<size_t>(slotBytes ? maxBytes / slotBytes : 0, maxLayers));
+        if (numSlots == 0)
+        {
+            ofLogWarning("TileAtlas") << "No room for a " << width << "x" << height << " slot";
+            return;
+        }
+
+        slotWidth = width;
+        slotHeight = height;
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, slotWidth, slotHeight, numSlots, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glGenFramebuffers(2, framebuffers);
+
+        owners.resize(numSlots);
+        lastFrame.assign(numSlots, 0);
+        for (int slot = 0; slot < numSlots; slot++)
+            usage.push_back(slot);
+        for (auto it = usage.begin(); it != usage.end(); ++it)
+            usageIterators.push_back(it);
+
+        ofLogNotice("TileAtlas") << numSlots << " slots of " << slotWidth << "x" << slotHeight << " (" << ((slotBytes * numSlots) >> 20) << " MB)";
+    }
+
+    void clear()
+    {
+        if (texture != 0)
+        {
+            glDeleteTextures(1, &texture);
+            glDeleteFramebuffers(2, framebuffers);
+        }
+        texture = 0;
+        numSlots = 0;
+        slots.clear();
+        owners.clear();
+        lastFrame.clear();
+        usage.clear();
+        usageIterators.clear();
+    }
+
+    bool isAllocated() const
+    {
+        return texture != 0;
+    }
+
+    // Slots used in the previous frame become available again
+    void nextFrame()
+    {
+        releaseSlots();
+        numCopies = 0;
+    }
+
+    // Slots used so far become available again, for once their tiles have
+    // been drawn. Their contents stay until they are taken.
+    void releaseSlots()
+    {
+        frame++;
+    }
+
+    /*
+        Layer holding `tile`, copied in if it is not there yet. -1 when the
+        tile does not fit a slot, every slot is taken by tiles of this frame
+        or the tile is compressed, which a blit cannot read.
+    */
+    int slot(const TileKey &key, const ofTexture &tile)
+    {
+        int slot = find(key);
+        if (slot >= 0)
+            return slot;
+
+        if (!holds(tile))
+            return -1;
+
+        slot = acquire(key, tile.getWidth(), tile.getHeight());
+        if (slot >= 0)
+            copy(tile, slot);
+        return slot;
+    }
+
+    // As above, uploading decoded pixels instead of copying a texture
+    int slot(const TileKey &key, const ofPixels &pixels)
+    {
+        int slot = find(key);
+        if (slot >= 0)
+            return slot;
+
+        slot = acquire(key, pixels.getWidth(), pixels.getHeight());
+        if (slot >= 0)
+            upload(pixels, slot);
+        return slot;
+    }
+
+    // False for tiles no slot can take however many are free: compressed
+    // ones, which a blit cannot read, and those larger than a slot
+    bool holds(const ofTexture &tile) const
+    {
+        return !CompressedTile::isCompressed(tile) && tile.getWidth() <= slotWidth && tile.getHeight() <= slotHeight;
+    }
+
+    // Layer of `key` if it is in the atlas, -1 otherwise. Found tiles count
+    // as used in this frame.
+    int find(const TileKey &key)
+    {
+        auto it = slots.find(key);
+        if (it == slots.end())
+            return -1;
+
+        use(it->second);
+        return it->second;
+    }
+
+    // As find, without counting the tile as used
+    bool contains(const TileKey &key) const
+    {
+        return slots.count(key) > 0;
+    }
+
+    GLuint getTextureId() const
+    {
+        return texture;
+    }
+
+    glm::vec2 getSlotSize() const
+    {
+        return {static_cast<float>(slotWidth), static_cast<float>(slotHeight)};
+    }
+
+    size_t size() const
+    {
+        return slots.size();
+    }
+
+    int getNumSlots() const
+    {
+        return numSlots;
+    }
+
+    // Tiles copied or uploaded since nextFrame()
+    size_t getNumCopies() const
+    {
+        return numCopies;
+    }
+
+    // Called with the tile that lost its slot to another one
+    std::function<void(const TileKey &, int)> onEvict;
+
+private:
+    int acquire(const TileKey &key, float width, float height)
+    {
+        if (width > slotWidth || height > slotHeight || usage.empty())
+            return -1;
+
+        int slot = usage.back();
+        if (lastFrame[slot] == frame)
+            return -1;
+
+        if (lastFrame[slot] != 0)
+        {
+            slots.erase(owners[slot]);
+            if (onEvict)
+                onEvict(owners[slot], slot);
+        }
+        owners[slot] = key;
+        slots[key] = slot;
+        use(slot);
+
+        numCopies++;
+        return slot;
+    }
+
+    void use(int slot)
+    {
+        lastFrame[slot] = frame;
+        usage.splice(usage.begin(), usage, usageIterators[slot]);
+    }
+
+    void copy(const ofTexture &tile, int slot)
+    {
+        const ofTextureData &data = tile.getTextureData();
+        int width = static_cast<int>(tile.getWidth());
+        int height = static_cast<int>(tile.getHeight());
+
+        // Called while the frame is being drawn into an fbo
+        GLint readFramebuffer = 0;
+        GLint drawFramebuffer = 0;
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, data.textureTarget, data.textureID, 0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, slot);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+    }
+
+    void upload(const ofPixels &pixels, int slot)
+    {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, slot, pixels.getWidth(), pixels.getHeight(), 1, ofGetGLFormat(pixels), GL_UNSIGNED_BYTE, pixels.getData());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    GLuint texture = 0;
+    GLuint framebuffers[2] = {0, 0};
+    int slotWidth = 0;
+    int slotHeight = 0;
+    int numSlots = 0;
+
+    // Frames start at 1, so a slot last used in frame 0 is empty
+    uint64_t frame = 1;
+    size_t numCopies = 0;
+
+    std::unordered_map<TileKey, int> slots;
+    std::vector<TileKey> owners;
+    std::vector<uint64_t> lastFrame;
+    std::list<int> usage; // most recently used first
+    std::vector<std::list<int>::iterator> usageIterators;
+};
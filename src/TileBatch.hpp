@@ -0,0 +1,122 @@
+#pragma once
+
+#include "ofMain.h"
+#include "TileAtlas.hpp"
+
+/*
+    Batched render path: the tiles of every tileset are collected as
+    instances of one unit quad and drawn with a single instanced call.
+    Each instance carries the tile rectangle, the atlas layers of its two
+    theta levels and the tileset's blend alpha, mixed in tiles.frag as
+    tile.frag does. The quad and the instance buffer persist across frames;
+    only the instances are uploaded, once per frame.
+*/
+class TileBatch
+{
+public:
+    bool setup()
+    {
+        if (!shader.load("tiles.vert", "tiles.frag"))
+            return false;
+
+        std::vector<glm::vec3> corners = {{0.f, 0.f, 0.f}, {1.f, 0.f, 0.f}, {0.f, 1.f, 0.f}, {1.f, 1.f, 0.f}};
+        quad.setVertexData(corners.data(), static_cast<int>(corners.size()), GL_STATIC_DRAW);
+
+        capacity = 1024;
+        instanceBuffer.allocate(capacity * sizeof(Instance), GL_STREAM_DRAW);
+
+        int rect = shader.getAttributeLocation("rect");
+        int layers = shader.getAttributeLocation("layers");
+        quad.setAttributeBuffer(rect, instanceBuffer, 4, sizeof(Instance), offsetof(Instance, rect));
+        quad.setAttributeBuffer(layers, instanceBuffer, 3, sizeof(Instance), offsetof(Instance, layers));
+        quad.setAttributeDivisor(rect, 1);
+        quad.setAttributeDivisor(layers, 1);
+        return true;
+    }
+
+    bool isReady() const
+    {
+        return shader.isLoaded() && atlas.isAllocated();
+    }
+
+    void begin()
+    {
+        atlas.nextFrame();
+        instances.clear();
+    }
+
+    /*
+        Adds a tile at `position` in world coordinates, blending `b` over `a`
+        by `alpha`. `a` and `b` may be the same tile. Returns false if the
+        atlas has no room for it until flush(), or cannot hold it at all
+        (see supports); the tile is then up to the caller to draw.
+    */
+    bool add(const TileKey &keyA, const ofTexture &a, const TileKey &keyB, const ofTexture &b, ofVec2f position, float alpha)
+    {
+        int layerA = atlas.slot(keyA, a);
+        int layerB = layerA >= 0 && keyB == keyA ? layerA : atlas.slot(keyB, b);
+        if (layerA < 0 || layerB < 0)
+            return false;
+
+        instances.push_back({{position.x, position.y, a.getWidth(), a.getHeight()}, {static_cast<float>(layerA), static_cast<float>(layerB), alpha}});
+        return true;
+    }
+
+    // False if the atlas can never hold `a` or `b`, so flushing would not
+    // make room for them
+    bool supports(const ofTexture &a, const ofTexture &b) const
+    {
+        return atlas.holds(a) && atlas.holds(b);
+    }
+
+    // Draws the tiles added so far, so their slots can take more tiles
+    void flush(const ofMatrix4x4 &viewMatrix)
+    {
+        draw(viewMatrix);
+        atlas.releaseSlots();
+        instances.clear();
+    }
+
+    void draw(const ofMatrix4x4 &viewMatrix)
+    {
+        if (instances.empty())
+            return;
+
+        size_t bytes = instances.size() * sizeof(Instance);
+        if (instances.size() > capacity)
+        {
+            capacity = instances.size() * 2;
+            instanceBuffer.allocate(capacity * sizeof(Instance), GL_STREAM_DRAW);
+        }
+        instanceBuffer.updateData(0, bytes, instances.data());
+
+        ofPushMatrix();
+        ofMultMatrix(viewMatrix);
+        shader.begin();
+        shader.setUniformTexture("atlas", GL_TEXTURE_2D_ARRAY, atlas.getTextureId(), 1);
+        shader.setUniform2f("slotSize", atlas.getSlotSize());
+        quad.drawInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<int>(instances.size()));
+        shader.end();
+        ofPopMatrix();
+    }
+
+    size_t size() const
+    {
+        return instances.size();
+    }
+
+    TileAtlas atlas;
+
+private:
+    struct Instance
+    {
+        glm::vec4 rect;   // world position and size
+        glm::vec3 layers; // atlas layers of t1 and t2, blend alpha
+    };
+
+    ofShader shader;
+    ofVbo quad;
+    ofBufferObject instanceBuffer;
+    size_t capacity = 0;
+    std::vector<Instance> instances;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "ofMain.h"
+#include "TileCacheLRU.hpp"
+
+#include <unordered_map>
+
+/*
+    Keys of the tiles in the main cache, bucketed by tileset and theta
+    level. Drawing a tileset only walks the two buckets of its current
+    theta levels instead of the whole cache. Kept in step with
+    ofApp::cacheMain by putMain and the demotion in updateCaches.
+*/
+class TileBuckets
+{
+public:
+    void insert(const TileKey &key)
+    {
+        Bucket &bucket = buckets[bucketId(key.tileset, key.theta)];
+        if (bucket.index.count(key))
+            return;
+
+        bucket.index[key] = bucket.keys.size();
+        bucket.keys.push_back(key);
+    }
+
+    void erase(const TileKey &key)
+    {
+        auto it = buckets.find(bucketId(key.tileset, key.theta));
+        if (it == buckets.end())
+            return;
+
+        // Swap with the last key, so erasing does not shift the others
+        Bucket &bucket = it->second;
+        auto index = bucket.index.find(key);
+        if (index == bucket.index.end())
+            return;
+
+        size_t i = index->second;
+        bucket.index.erase(index);
+        if (i != bucket.keys.size() - 1)
+        {
+            bucket.keys[i] = bucket.keys.back();
+            bucket.index[bucket.keys[i]] = i;
+        }
+        bucket.keys.pop_back();
+    }
+
+    const std::vector<TileKey> &get(TilesetId tileset, Theta theta) const
+    {
+        static const std::vector<TileKey> empty;
+        auto it = buckets.find(bucketId(tileset, static_cast<int16_t>(theta)));
+        return it != buckets.end() ? it->second.keys : empty;
+    }
+
+    void clear()
+    {
+        buckets.clear();
+    }
+
+private:
+    struct Bucket
+    {
+        std::vector<TileKey> keys;
+        std::unordered_map<TileKey, size_t> index;
+    };
+
+    static uint32_t bucketId(TilesetId tileset, int16_t theta)
+    {
+        return (static_cast<uint32_t>(tileset) << 16) | static_cast<uint16_t>(theta);
+    }
+
+    std::unordered_map<uint32_t, Bucket> buckets;
+};
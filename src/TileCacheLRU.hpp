@@ -14,17 +14,48 @@ namespace std
     {
         size_t operator()(const TileKey &k) const
         {
-            return k.hash;
+            return k.hash();
         }
     };
 }
 
+// GPU memory held by a texture, from its allocated size and internal format
+inline size_t textureBytes(const ofTexture &texture)
+{
+    if (!texture.isAllocated())
+        return 0;
+
+    const ofTextureData &data = texture.getTextureData();
+
+    // BC1 tiles (see CompressedTile) take 8 bytes per 4x4 block
+    if (data.glInternalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+        return static_cast<size_t>((data.tex_w + 3) / 4) * static_cast<size_t>((data.tex_h + 3) / 4) * 8;
+
+    int glFormat = ofGetGLFormatFromInternal(data.glInternalFormat);
+    int glType = ofGetGLTypeFromInternal(data.glInternalFormat);
+    size_t bytesPerPixel = ofGetNumChannelsFromGLFormat(glFormat) * ofGetBytesPerChannelFromGLType(glType);
+
+    return static_cast<size_t>(data.tex_w) * static_cast<size_t>(data.tex_h) * bytesPerPixel;
+}
+
+/*
+    Least recently used texture cache with a budget in bytes. `reserved`
+    bytes are held elsewhere (the main cache tier) and count against the
+    same budget, so this tier shrinks as the other one grows.
+*/
 class TileCacheLRU
 {
 public:
-    TileCacheLRU(size_t maxSize) : maxSize(maxSize) {}
+    TileCacheLRU(size_t maxBytes) : maxBytes(maxBytes) {}
+
+    struct Entry
+    {
+        ofTexture texture;
+        size_t bytes;
+        std::list<TileKey>::iterator usage;
+    };
 
-    using CacheMap = std::unordered_map<TileKey, std::pair<ofTexture, std::list<TileKey>::iterator>>;
+    using CacheMap = std::unordered_map<TileKey, Entry>;
     using const_iterator = CacheMap::const_iterator;
     using iterator = CacheMap::iterator;
 
@@ -42,8 +73,8 @@ public:
         if (it == cache.end())
             return false;
         // Move to front
-        usage.splice(usage.begin(), usage, it->second.second);
-        outImg = it->second.first;
+        usage.splice(usage.begin(), usage, it->second.usage);
+        outImg = it->second.texture;
         return true;
     }
 
@@ -51,7 +82,7 @@ public:
     {
         if (it == cache.end())
             return;
-        usage.splice(usage.begin(), usage, it->second.second);
+        usage.splice(usage.begin(), usage, it->second.usage);
     }
 
     void touch(const TileKey &key)
@@ -62,26 +93,24 @@ public:
 
     void put(const TileKey &key, const ofTexture &img)
     {
+        size_t bytes = textureBytes(img);
+
         auto it = cache.find(key);
         if (it != cache.end())
         {
-            usage.splice(usage.begin(), usage, it->second.second);
-            it->second.first = img;
-            return;
+            usage.splice(usage.begin(), usage, it->second.usage);
+            usedBytes = usedBytes - it->second.bytes + bytes;
+            it->second.texture = img;
+            it->second.bytes = bytes;
         }
-
-        if (cache.size() >= maxSize)
+        else
         {
-            TileKey oldKey = usage.back();
-            auto it = cache.find(oldKey);
-            if (it != cache.end())
-            {
-                usage.erase(it->second.second); // erase from list using stored iterator
-                cache.erase(it);                // then erase from cache
-            }
+            usage.push_front(key);
+            cache[key] = {img, bytes, usage.begin()};
+            usedBytes += bytes;
         }
-        usage.push_front(key);
-        cache[key] = {img, usage.begin()};
+
+        evict();
     }
 
     void erase(const TileKey &key)
@@ -89,11 +118,34 @@ public:
         auto it = cache.find(key);
         if (it != cache.end())
         {
-            usage.erase(it->second.second);
+            usedBytes -= it->second.bytes;
+            usage.erase(it->second.usage);
             cache.erase(it);
         }
     }
 
+    void setMaxBytes(size_t bytes)
+    {
+        maxBytes = bytes;
+        evict();
+    }
+
+    void setReservedBytes(size_t bytes)
+    {
+        reservedBytes = bytes;
+        evict();
+    }
+
+    size_t getMaxBytes() const
+    {
+        return maxBytes;
+    }
+
+    size_t getUsedBytes() const
+    {
+        return usedBytes;
+    }
+
     size_t size()
     {
         return cache.size();
@@ -105,7 +157,20 @@ public:
     const_iterator end() const { return cache.end(); }
 
 private:
-    size_t maxSize;
+    void evict()
+    {
+        while (usage.size() && usedBytes + reservedBytes > maxBytes)
+        {
+            auto it = cache.find(usage.back());
+            usedBytes -= it->second.bytes;
+            usage.pop_back();
+            cache.erase(it);
+        }
+    }
+
+    size_t maxBytes;
+    size_t usedBytes = 0;
+    size_t reservedBytes = 0;
     std::list<TileKey> usage;
-    std::unordered_map<TileKey, std::pair<ofTexture, std::list<TileKey>::iterator>> cache;
+    CacheMap cache;
 };
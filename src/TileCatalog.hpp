@@ -0,0 +1,331 @@
+#pragma once
+
+#include "ofMain.h"
+#include "TileKey.h"
+
+#include <filesystem>
+#include <fstream>
+#include <span>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Geometry of one tile in the catalog. The zoom and tileset are implied
+// by the level the record belongs to, and the same record stands for the
+// tile at every theta level.
+struct CatalogTile
+{
+    int32_t x;
+    int32_t y;
+    uint16_t width;
+    uint16_t height;
+};
+
+static_assert(sizeof(CatalogTile) == 12);
+
+/*
+    View of the tiles of one zoom level, pointing straight into the mapped
+    catalog. Keys for a theta level are assembled on access.
+*/
+class TileLevel
+{
+public:
+    TileLevel() = default;
+    TileLevel(std::span<const CatalogTile> tiles, Zoom zoom, TilesetId tileset) : tiles(tiles), zoom(zoom), tileset(tileset) {}
+
+    TileKey key(size_t i, Theta theta) const
+    {
+        const CatalogTile &t = tiles[i];
+        return {zoom, t.x, t.y, t.width, t.height, static_cast<int>(theta), tileset};
+    }
+
+    size_t size() const
+    {
+        return tiles.size();
+    }
+
+    std::span<const CatalogTile> records() const
+    {
+        return tiles;
+    }
+
+private:
+    std::span<const CatalogTile> tiles;
+    Zoom zoom = 0;
+    TilesetId tileset = 0;
+};
+
+/*
+    Binary tile catalog of one tileset (`tilecatalog.bin`), mapped into
+    memory and used in place. Replaces parsing `tilelist.json` on every
+    start. The catalog stores the modification time of the scan folders it
+    was built from and is rejected, and rebuilt, when they change or the
+    format version differs.
+
+    Layout: Header, then 8 byte aligned sections of theta levels, zoom
+    records and tile records. Each zoom record owns a range of tiles that
+    is shared by all theta levels; file names follow from the tile
+    geometry (see TilesetManager::tilePath).
+*/
+class TileCatalog
+{
+public:
+    static constexpr char magic[8] = {'T', 'S', 'C', 'C', 'A', 'T', 'L', 'G'};
+    static constexpr uint32_t version = 2;
+
+    struct ZoomRecord
+    {
+        int32_t zoom;
+        float width;
+        float height;
+        uint32_t reserved;
+        uint64_t first;
+        uint64_t count;
+    };
+
+    // Everything needed to write a catalog, filled by a directory scan or
+    // a JSON import
+    struct Contents
+    {
+        std::vector<int32_t> thetas;
+        std::vector<ZoomRecord> zooms;
+        std::vector<CatalogTile> tiles;
+    };
+
+    TileCatalog() {}
+    TileCatalog(const TileCatalog &) = delete;
+    TileCatalog &operator=(const TileCatalog &) = delete;
+
+    ~TileCatalog()
+    {
+        close();
+    }
+
+    static bool write(const std::filesystem::path &path, const Contents &contents, int64_t sourceTime)
+    {
+        Header header{};
+        std::copy(std::begin(magic), std::end(magic), header.magic);
+        header.version = version;
+        header.sourceTime = sourceTime;
+        header.numThetas = static_cast<uint32_t>(contents.thetas.size());
+        header.numZooms = static_cast<uint32_t>(contents.zooms.size());
+        header.numTiles = contents.tiles.size();
+
+        uint64_t offset = align(sizeof(Header));
+        auto section = [&offset](uint64_t bytes)
+        {
+            uint64_t start = offset;
+            offset = align(offset + bytes);
+            return start;
+        };
+        header.thetasOffset = section(contents.thetas.size() * sizeof(int32_t));
+        header.zoomsOffset = section(contents.zooms.size() * sizeof(ZoomRecord));
+        header.tilesOffset = section(contents.tiles.size() * sizeof(CatalogTile));
+        header.fileSize = offset;
+
+        // Written next to the catalog and renamed, so a reader never maps a
+        // partially written file
+        std::filesystem::path tmpPath = path;
+        tmpPath += ".tmp";
+
+        {
+            std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            if (!out)
+                return false;
+
+            auto put = [&out](uint64_t at, const void *data, size_t bytes)
+            {
+                out.seekp(at);
+                out.write(static_cast<const char *>(data), bytes);
+            };
+
+            put(0, &header, sizeof(Header));
+            put(header.thetasOffset, contents.thetas.data(), contents.thetas.size() * sizeof(int32_t));
+            put(header.zoomsOffset, contents.zooms.data(), contents.zooms.size() * sizeof(ZoomRecord));
+            put(header.tilesOffset, contents.tiles.data(), contents.tiles.size() * sizeof(CatalogTile));
+
+            // Pad to the recorded size
+            out.seekp(header.fileSize - 1);
+            out.put('\0');
+
+            if (!out)
+                return false;
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, path, ec);
+        return !ec;
+    }
+
+    // Maps the catalog at `path`. Fails if it is missing, malformed, from
+    // another format version or older than `sourceTime`.
+    bool open(const std::filesystem::path &path, int64_t sourceTime)
+    {
+        close();
+
+        if (!map(path))
+            return false;
+
+        if (!validate(sourceTime))
+        {
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+        if (data != nullptr)
+            munmap(const_cast<uint8_t *>(data), size);
+#endif
+        data = nullptr;
+        size = 0;
+        storage.clear();
+    }
+
+    bool isOpen() const
+    {
+        return data != nullptr;
+    }
+
+    std::span<const int32_t> thetas() const
+    {
+        return section<int32_t>(header().thetasOffset, header().numThetas);
+    }
+
+    std::span<const ZoomRecord> zooms() const
+    {
+        return section<ZoomRecord>(header().zoomsOffset, header().numZooms);
+    }
+
+    std::span<const CatalogTile> tiles(const ZoomRecord &zoom) const
+    {
+        return section<CatalogTile>(header().tilesOffset, header().numTiles).subspan(zoom.first, zoom.count);
+    }
+
+    size_t numTiles() const
+    {
+        return header().numTiles;
+    }
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t numThetas;
+        int64_t sourceTime;
+        uint32_t numZooms;
+        uint32_t reserved;
+        uint64_t numTiles;
+        uint64_t thetasOffset;
+        uint64_t zoomsOffset;
+        uint64_t tilesOffset;
+        uint64_t fileSize;
+    };
+
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + 7) & ~uint64_t(7);
+    }
+
+    const Header &header() const
+    {
+        return *reinterpret_cast<const Header *>(data);
+    }
+
+    template <typename T>
+    std::span<const T> section(uint64_t offset, uint64_t count) const
+    {
+        return {reinterpret_cast<const T *>(data + offset), count};
+    }
+
+    bool map(const std::filesystem::path &path)
+    {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header)))
+        {
+            ::close(fd);
+            return false;
+        }
+
+        void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+            return false;
+
+        data = static_cast<const uint8_t *>(mapped);
+        size = st.st_size;
+#else
+        // No mapping here, the catalog is read in one go instead
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in)
+            return false;
+
+        size = in.tellg();
+        if (size < sizeof(Header))
+            return false;
+
+        storage.resize(size);
+        in.seekg(0);
+        if (!in.read(reinterpret_cast<char *>(storage.data()), size))
+            return false;
+
+        data = storage.data();
+#endif
+        return true;
+    }
+
+    bool validate(int64_t sourceTime) const
+    {
+        const Header &h = header();
+
+        if (!std::equal(std::begin(magic), std::end(magic), h.magic))
+            return false;
+
+        if (h.version != version)
+        {
+            ofLogNotice() << "TileCatalog version " << h.version << " is outdated, expected " << version;
+            return false;
+        }
+
+        if (h.sourceTime != sourceTime)
+        {
+            ofLogNotice() << "TileCatalog is out of date with the scan folders";
+            return false;
+        }
+
+        if (h.fileSize != size)
+            return false;
+
+        auto fits = [this](uint64_t offset, uint64_t bytes)
+        { return offset % 8 == 0 && offset <= size && bytes <= size - offset; };
+
+        if (!fits(h.thetasOffset, h.numThetas * sizeof(int32_t)) ||
+            !fits(h.zoomsOffset, h.numZooms * sizeof(ZoomRecord)) ||
+            !fits(h.tilesOffset, h.numTiles * sizeof(CatalogTile)))
+            return false;
+
+        for (const ZoomRecord &zoom : zooms())
+            if (zoom.first > h.numTiles || zoom.count > h.numTiles - zoom.first)
+                return false;
+
+        return true;
+    }
+
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    std::vector<uint8_t> storage;
+};
@@ -0,0 +1,312 @@
+#pragma once
+
+#include "ofMain.h"
+#include "TilesetManager.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+/*
+    Composes still images straight from the tile files on the CPU, without
+    a window or GL context. Any rectangle of the layout is rendered at any
+    zoom level and theta: the tiles under it are decoded on a pool of
+    threads and copied, or blended between the two theta levels around
+    `theta` as blend.frag does, row by row into the output.
+
+    The tiles of a level do not overlap and neither do the tilesets of a
+    layout, so every worker writes its own part of the output.
+
+    With carry-over enabled, tiles reaching below the composed rectangle
+    are kept decoded for the next compose() call, so composing an image in
+    consecutive bands decodes every tile once.
+*/
+class TileCompositor
+{
+public:
+    /*
+        Takes a snapshot of the layout, so the app can keep moving and
+        rescaling while an export runs. `layoutZoom` is the zoom the
+        tileset offsets are currently in.
+    */
+    TileCompositor(const TilesetManager &tilesetManager, Zoom layoutZoom, size_t numThreads = 0)
+    {
+        for (const std::shared_ptr<TileSet> &tileset : tilesetManager.tilesetList)
+            sources.push_back({tileset, tilesetManager.tilesetsRoot / tileset->name, tileset->offset * layoutZoom});
+
+        if (numThreads == 0)
+            numThreads = std::thread::hardware_concurrency();
+        this->numThreads = std::max<size_t>(numThreads, 1);
+    }
+
+    // Bounds of the whole layout in pixels of `zoom`
+    ofRectangle getLayoutBounds(Zoom zoom) const
+    {
+        ofRectangle bounds;
+        bool first = true;
+        for (const Source &source : sources)
+        {
+            auto size = source.tileset->zoomWorldSizes.find(zoom);
+            if (size == source.tileset->zoomWorldSizes.end())
+                continue;
+
+            ofRectangle rect(source.offset / zoom, size->second.x, size->second.y);
+            if (first)
+                bounds = rect;
+            else
+                bounds.growToInclude(rect);
+            first = false;
+        }
+        return bounds;
+    }
+
+    /*
+        Renders `bounds`, in layout pixels of `zoom`, at `theta` into `dst`
+        as RGB. Areas without tiles are black. Returns false if a tile could
+        not be loaded or the export was cancelled.
+    */
+    bool compose(const ofRectangle &bounds, Zoom zoom, Theta theta, ofPixels &dst)
+    {
+        int x0 = static_cast<int>(std::floor(bounds.getLeft()));
+        int y0 = static_cast<int>(std::floor(bounds.getTop()));
+        int width = static_cast<int>(std::ceil(bounds.getRight())) - x0;
+        int height = static_cast<int>(std::ceil(bounds.getBottom())) - y0;
+
+        if (dst.getWidth() != static_cast<size_t>(width) || dst.getHeight() != static_cast<size_t>(height) || dst.getNumChannels() != 3)
+            dst.allocate(width, height, OF_PIXELS_RGB);
+        std::fill(dst.begin(), dst.end(), 0);
+
+        std::vector<Job> jobs;
+        for (const Source &source : sources)
+            addJobs(source, zoom, theta, x0, y0, width, height, jobs);
+
+        tilesTotal = jobs.size();
+        tilesDone = 0;
+        kept.clear();
+
+        std::atomic<size_t> next = 0;
+        std::atomic<size_t> failed = 0;
+        auto work = [&]
+        {
+            ofPixels tileA;
+            ofPixels tileB;
+            for (size_t i = next++; i < jobs.size() && !cancelled; i = next++)
+            {
+                if (!draw(jobs[i], tileA, tileB, dst))
+                    failed++;
+                tilesDone++;
+            }
+        };
+
+        // The calling thread is one of the workers
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < std::min(numThreads, jobs.size()); i++)
+            workers.emplace_back(work);
+        work();
+        for (std::thread &worker : workers)
+            worker.join();
+
+        std::swap(carried, kept);
+        kept.clear();
+
+        if (failed > 0)
+            ofLogWarning("TileCompositor") << failed << " of " << jobs.size() << " tiles could not be loaded";
+
+        return failed == 0 && !cancelled;
+    }
+
+    // Stops a compose() running on another thread after its current tiles,
+    // or makes the next one return at once. A cancelled compositor stays
+    // cancelled, so every export starts with a new one.
+    void cancel()
+    {
+        cancelled = true;
+    }
+
+    void setCarryOver(bool enabled)
+    {
+        carryOver = enabled;
+        if (!enabled)
+            carried.clear();
+    }
+
+    size_t getTilesDone() const
+    {
+        return tilesDone;
+    }
+
+    size_t getTilesTotal() const
+    {
+        return tilesTotal;
+    }
+
+    // Mixes two rows as blend.frag does, `weight` of `b` in 1/256ths
+    static void blendRow(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t n, uint32_t weight)
+    {
+        const uint32_t inverse = 256 - weight;
+        for (size_t i = 0; i < n; i++)
+            dst[i] = static_cast<uint8_t>((a[i] * inverse + b[i] * weight + 128) >> 8);
+    }
+
+private:
+    struct Source
+    {
+        std::shared_ptr<TileSet> tileset;
+        std::filesystem::path path;
+        ofVec2f offset; // full resolution pixels
+    };
+
+    struct Job
+    {
+        std::string pathA;
+        std::string pathB; // empty when only one theta level contributes
+        uint32_t weight;
+        bool carry; // the tile reaches below the output
+
+        // Output rectangle and the tile's top left corner in output pixels
+        int left;
+        int top;
+        int right;
+        int bottom;
+        int tileX;
+        int tileY;
+    };
+
+    void addJobs(const Source &source, Zoom zoom, Theta theta, int x0, int y0, int width, int height, std::vector<Job> &jobs) const
+    {
+        const TileSet &tileset = *source.tileset;
+        auto grid = tileset.tileGrids.find(zoom);
+        auto level = tileset.avaliableTiles.find(zoom);
+        if (grid == tileset.tileGrids.end() || level == tileset.avaliableTiles.end() || tileset.thetaLevels.empty())
+            return;
+
+        // Theta levels and weight as in TilesetManager::updateTheta
+        int thetaIndex = TilesetManager::thetaLevelIndex(tileset, theta);
+        Theta t1 = tileset.thetaLevels[thetaIndex];
+        Theta t2 = tileset.thetaLevels[(thetaIndex + 1) % tileset.thetaLevels.size()];
+        float t2Unwrapped = thetaIndex == static_cast<int>(tileset.thetaLevels.size()) - 1 ? tileset.thetaLevels[0] + 180.f : t2;
+        float alpha = std::clamp(ofMap(theta, t1, t2Unwrapped, 0.f, 1.f), 0.f, 1.f);
+        uint32_t weight = static_cast<uint32_t>(std::lround(alpha * 256.f));
+
+        ofVec2f offset = source.offset / zoom;
+        int offsetX = static_cast<int>(std::lround(offset.x)) - x0;
+        int offsetY = static_cast<int>(std::lround(offset.y)) - y0;
+        ofRectangle local(-offsetX, -offsetY, width, height);
+
+        const TileLevel &tiles = level->second;
+        grid->second.query(local, [&](uint32_t index)
+                           {
+            const CatalogTile &tile = tiles.records()[index];
+            Job job;
+            job.tileX = tile.x + offsetX;
+            job.tileY = tile.y + offsetY;
+            job.left = std::max(job.tileX, 0);
+            job.top = std::max(job.tileY, 0);
+            job.right = std::min(job.tileX + static_cast<int>(tile.width), width);
+            job.bottom = std::min(job.tileY + static_cast<int>(tile.height), height);
+            if (job.left >= job.right || job.top >= job.bottom)
+                return;
+
+            if (weight == 256)
+                job.pathA = TilesetManager::tilePath(source.path, tiles.key(index, t2));
+            else
+                job.pathA = TilesetManager::tilePath(source.path, tiles.key(index, t1));
+            if (weight > 0 && weight < 256)
+                job.pathB = TilesetManager::tilePath(source.path, tiles.key(index, t2));
+            job.weight = weight;
+            job.carry = carryOver && job.tileY + static_cast<int>(tile.height) > height;
+
+            jobs.push_back(std::move(job)); });
+    }
+
+    static bool load(const std::string &path, ofPixels &pixels)
+    {
+        if (!ofLoadImage(pixels, path))
+            return false;
+
+        if (pixels.getNumChannels() != 3)
+            pixels.setImageType(OF_IMAGE_COLOR);
+        return true;
+    }
+
+    // The decoded tile at `path`, from the previous call's carried tiles
+    // or decoded into `scratch`
+    const ofPixels *acquire(const std::string &path, bool carry, ofPixels &scratch)
+    {
+        std::shared_ptr<ofPixels> pixels;
+        auto it = carried.find(path);
+        if (it != carried.end())
+            pixels = it->second;
+        else if (!load(path, scratch))
+            return nullptr;
+        else if (!carry)
+            return &scratch;
+        else
+            pixels = std::make_shared<ofPixels>(std::move(scratch));
+
+        if (carry)
+        {
+            std::lock_guard<std::mutex> lock(keptMutex);
+            kept[path] = pixels;
+        }
+        return pixels.get();
+    }
+
+    bool draw(const Job &job, ofPixels &scratchA, ofPixels &scratchB, ofPixels &dst)
+    {
+        const ofPixels *a = acquire(job.pathA, job.carry, scratchA);
+        if (a == nullptr)
+            return false;
+        const ofPixels &tileA = *a;
+
+        bool blend = !job.pathB.empty();
+        const ofPixels *b = blend ? acquire(job.pathB, job.carry, scratchB) : &scratchB;
+        if (b == nullptr)
+            return false;
+        const ofPixels &tileB = *b;
+
+        // Tiles are clipped to their image, in case it is smaller than the
+        // catalog says
+        int right = std::min<int>(job.right, job.tileX + tileA.getWidth());
+        int bottom = std::min<int>(job.bottom, job.tileY + tileA.getHeight());
+        if (blend)
+        {
+            right = std::min<int>(right, job.tileX + tileB.getWidth());
+            bottom = std::min<int>(bottom, job.tileY + tileB.getHeight());
+        }
+        if (job.left >= right || job.top >= bottom)
+            return true;
+
+        size_t rowBytes = static_cast<size_t>(right - job.left) * 3;
+        size_t dstStride = dst.getWidth() * 3;
+        size_t strideA = tileA.getWidth() * 3;
+        size_t strideB = tileB.getWidth() * 3;
+        size_t srcX = static_cast<size_t>(job.left - job.tileX) * 3;
+
+        for (int y = job.top; y < bottom; y++)
+        {
+            size_t srcY = y - job.tileY;
+            uint8_t *out = dst.getData() + y * dstStride + job.left * 3;
+            const uint8_t *a = tileA.getData() + srcY * strideA + srcX;
+            if (blend)
+                blendRow(out, a, tileB.getData() + srcY * strideB + srcX, rowBytes, job.weight);
+            else
+                std::memcpy(out, a, rowBytes);
+        }
+        return true;
+    }
+
+    std::vector<Source> sources;
+    size_t numThreads;
+
+    std::atomic<size_t> tilesDone = 0;
+    std::atomic<size_t> tilesTotal = 0;
+    std::atomic<bool> cancelled = false;
+
+    // Read only while composing; tiles to carry are collected in `kept`
+    bool carryOver = false;
+    std::unordered_map<std::string, std::shared_ptr<ofPixels>> carried;
+    std::unordered_map<std::string, std::shared_ptr<ofPixels>> kept;
+    std::mutex keptMutex;
+};
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "ofMain.h"
+#include <span>
+
+/*
+    Uniform grid over the tiles of one zoom and theta level, so the tiles
+    under a rectangle are found without walking the whole level. Cells are
+    at least as large as the largest tile and every tile is stored in the
+    cell holding its top left corner, so a query only has to look one cell
+    above and to the left of the rectangle for tiles reaching into it.
+    Cells hold indices into the level's tiles, and a tile is anything
+    with integer `x`, `y`, `width` and `height` members.
+*/
+class TileGrid
+{
+public:
+    template <typename Tile>
+    void build(std::span<const Tile> tiles)
+    {
+        cells.clear();
+        cellStart.clear();
+        columns = rows = 0;
+
+        if (tiles.empty())
+            return;
+
+        int minX = std::numeric_limits<int>::max();
+        int minY = std::numeric_limits<int>::max();
+        int maxX = std::numeric_limits<int>::min();
+        int maxY = std::numeric_limits<int>::min();
+        cellSize = 1;
+
+        for (const Tile &key : tiles)
+        {
+            minX = std::min(minX, static_cast<int>(key.x));
+            minY = std::min(minY, static_cast<int>(key.y));
+            maxX = std::max(maxX, static_cast<int>(key.x));
+            maxY = std::max(maxY, static_cast<int>(key.y));
+            cellSize = std::max({cellSize, static_cast<int>(key.width), static_cast<int>(key.height)});
+        }
+
+        originX = minX;
+        originY = minY;
+        columns = (maxX - minX) / cellSize + 1;
+        rows = (maxY - minY) / cellSize + 1;
+
+        // Counting sort of the tile indices by cell into one flat array
+        cellStart.assign(columns * rows + 1, 0);
+        for (const Tile &key : tiles)
+            cellStart[cellIndex(key) + 1]++;
+
+        for (size_t i = 1; i < cellStart.size(); i++)
+            cellStart[i] += cellStart[i - 1];
+
+        cells.resize(tiles.size());
+        std::vector<uint32_t> fill(cellStart.begin(), cellStart.end() - 1);
+        for (uint32_t i = 0; i < tiles.size(); i++)
+            cells[fill[cellIndex(tiles[i])]++] = i;
+    }
+
+    // Calls `visit(index)` for every tile whose cell may overlap `rect`.
+    // Candidates still need an exact test.
+    template <typename Visit>
+    void query(const ofRectangle &rect, Visit &&visit) const
+    {
+        if (cells.empty())
+            return;
+
+        int c0 = static_cast<int>(std::floor((rect.getLeft() - originX) / cellSize)) - 1;
+        int r0 = static_cast<int>(std::floor((rect.getTop() - originY) / cellSize)) - 1;
+        int c1 = static_cast<int>(std::floor((rect.getRight() - originX) / cellSize));
+        int r1 = static_cast<int>(std::floor((rect.getBottom() - originY) / cellSize));
+
+        c0 = std::max(c0, 0);
+        r0 = std::max(r0, 0);
+        c1 = std::min(c1, columns - 1);
+        r1 = std::min(r1, rows - 1);
+
+        for (int r = r0; r <= r1; r++)
+        {
+            for (int c = c0; c <= c1; c++)
+            {
+                size_t cell = r * columns + c;
+                for (uint32_t i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+                    visit(cells[i]);
+            }
+        }
+    }
+
+    /*
+        True if every tile starts on a cell corner and no cell holds more
+        than one tile, as in a regular tile pyramid. Cells then address
+        tiles directly (see tileAt), which VirtualTexture relies on.
+    */
+    template <typename Tile>
+    bool isRegular(std::span<const Tile> tiles) const
+    {
+        for (size_t cell = 0; cell + 1 < cellStart.size(); cell++)
+        {
+            if (cellStart[cell + 1] - cellStart[cell] > 1)
+                return false;
+        }
+
+        for (const Tile &key : tiles)
+        {
+            if ((key.x - originX) % cellSize != 0 || (key.y - originY) % cellSize != 0)
+                return false;
+        }
+        return true;
+    }
+
+    // Index of the first tile of a cell, -1 for empty cells and cells
+    // outside the grid
+    int64_t tileAt(int column, int row) const
+    {
+        if (column < 0 || row < 0 || column >= columns || row >= rows)
+            return -1;
+
+        size_t cell = row * columns + column;
+        return cellStart[cell] < cellStart[cell + 1] ? cells[cellStart[cell]] : -1;
+    }
+
+    int getColumns() const
+    {
+        return columns;
+    }
+
+    int getRows() const
+    {
+        return rows;
+    }
+
+    int getCellSize() const
+    {
+        return cellSize;
+    }
+
+    glm::vec2 getOrigin() const
+    {
+        return {static_cast<float>(originX), static_cast<float>(originY)};
+    }
+
+private:
+    template <typename Tile>
+    size_t cellIndex(const Tile &key) const
+    {
+        int c = (key.x - originX) / cellSize;
+        int r = (key.y - originY) / cellSize;
+        return r * columns + c;
+    }
+
+    int originX = 0;
+    int originY = 0;
+    int cellSize = 1;
+    int columns = 0;
+    int rows = 0;
+    std::vector<uint32_t> cellStart;
+    std::vector<uint32_t> cells;
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "ofMain.h"
+#include "CompressedTile.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+
+/*
+    Transcodes the JPEG tiles of tilesets to their BC1 sidecars (see
+    CompressedTile), so the viewer can upload them without decoding. Each
+    folder is either a tileset or a folder of tilesets. Tiles whose sidecar
+    is newer than the JPEG are skipped, so ingesting again only picks up
+    new or changed tiles. The tiles are spread over every core.
+*/
+inline int runTileIngest(const std::vector<std::filesystem::path> &folders)
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+
+    // A tileset holds <zoom>.0 folders
+    auto isTileset = [&](const fs::path &folder)
+    {
+        for (const fs::directory_entry &entry : fs::directory_iterator(folder, ec))
+        {
+            std::string name = entry.path().filename().string();
+            if (entry.is_directory(ec) && name.ends_with(".0") && std::isdigit(static_cast<unsigned char>(name[0])))
+                return true;
+        }
+        return false;
+    };
+
+    std::vector<fs::path> tilesets;
+    for (const fs::path &folder : folders)
+    {
+        if (isTileset(folder))
+        {
+            tilesets.push_back(folder);
+            continue;
+        }
+        for (const fs::directory_entry &entry : fs::directory_iterator(folder, ec))
+            if (entry.is_directory(ec) && isTileset(entry.path()))
+                tilesets.push_back(entry.path());
+    }
+
+    if (tilesets.empty())
+    {
+        ofLogError() << "Tile ingest: no tilesets found";
+        return 1;
+    }
+
+    // <tileset>/<zoom>.0/<theta>.0/<tile>.jpg, hidden folders excluded
+    std::vector<fs::path> tiles;
+    size_t upToDate = 0;
+    for (const fs::path &tileset : tilesets)
+    {
+        for (const fs::directory_entry &zoomDir : fs::directory_iterator(tileset, ec))
+        {
+            if (!zoomDir.is_directory(ec) || zoomDir.path().filename().string().starts_with("."))
+                continue;
+
+            for (const fs::directory_entry &thetaDir : fs::directory_iterator(zoomDir, ec))
+            {
+                if (!thetaDir.is_directory(ec))
+                    continue;
+
+                for (const fs::directory_entry &file : fs::directory_iterator(thetaDir, ec))
+                {
+                    if (file.path().extension() != ".jpg")
+                        continue;
+
+                    if (CompressedTile::isCurrent(file.path()))
+                        upToDate++;
+                    else
+                        tiles.push_back(file.path());
+                }
+            }
+        }
+    }
+
+    ofLogNotice() << "Tile ingest: " << tilesets.size() << " tilesets, " << tiles.size() << " tiles to transcode, " << upToDate << " up to date";
+
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next = 0;
+    std::atomic<size_t> done = 0;
+    std::atomic<size_t> failed = 0;
+    std::atomic<size_t> bytes = 0;
+
+    auto work = [&]
+    {
+        ofPixels pixels;
+        for (size_t i = next++; i < tiles.size(); i = next++)
+        {
+            fs::path sidecar = CompressedTile::sidecarPath(tiles[i]);
+            bool loaded = ofLoadImage(pixels, tiles[i]);
+            if (loaded && pixels.getNumChannels() != 3)
+                pixels.setImageType(OF_IMAGE_COLOR);
+
+            if (!loaded || !CompressedTile::write(sidecar, pixels))
+            {
+                ofLogError() << "Tile ingest: failed to transcode " << tiles[i];
+                failed++;
+                continue;
+            }
+            bytes += CompressedTile::dataBytes(pixels.getWidth(), pixels.getHeight());
+
+            size_t count = ++done;
+            if (count % 1000 == 0)
+                ofLogNotice() << "Tile ingest: " << count << "/" << tiles.size();
+        }
+    };
+
+    size_t numThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < std::min(numThreads, tiles.size()); i++)
+        workers.emplace_back(work);
+    work();
+    for (std::thread &worker : workers)
+        worker.join();
+
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    ofLogNotice() << "Tile ingest: " << done << " tiles (" << (bytes >> 20) << " MB) in " << seconds << " s on " << numThreads << " threads, " << failed << " failed";
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ofMain.h"
+
+using Theta = float;
+using Zoom = int;
+
+template <class T>
+inline void hash_combine(std::size_t &seed, const T &v)
+{
+    std::hash<T> hasher;
+    seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+using TilesetId = uint16_t;
+
+/*
+    Identifies one tile image. Plain data so it is cheap to copy and hash;
+    the tileset is an interned id (see TilesetManager) and the file path
+    follows from the other fields, resolved only when the tile is loaded.
+*/
+struct TileKey
+{
+    int32_t x;
+    int32_t y;
+    uint16_t width;
+    uint16_t height;
+    uint16_t zoom;
+    int16_t theta;
+    TilesetId tileset;
+
+    TileKey() = default;
+    TileKey(int z, int xx, int yy, int w, int h, int t, TilesetId set) : x(xx), y(yy),
+                                                                         width(static_cast<uint16_t>(w)),
+                                                                         height(static_cast<uint16_t>(h)),
+                                                                         zoom(static_cast<uint16_t>(z)),
+                                                                         theta(static_cast<int16_t>(t)),
+                                                                         tileset(set)
+    {
+    }
+
+    bool operator==(const TileKey &other) const
+    {
+        return x == other.x && y == other.y && width == other.width && height == other.height &&
+               zoom == other.zoom && theta == other.theta && tileset == other.tileset;
+    }
+
+    size_t hash() const
+    {
+        size_t seed = std::hash<int32_t>()(x);
+        hash_combine(seed, y);
+        hash_combine(seed, (static_cast<uint32_t>(width) << 16) | height);
+        hash_combine(seed, (static_cast<uint32_t>(zoom) << 16) | static_cast<uint16_t>(theta));
+        hash_combine(seed, tileset);
+        return seed;
+    }
+};
+
+static_assert(std::is_trivially_copyable_v<TileKey>);
+static_assert(sizeof(TileKey) <= 20);
@@ -14,152 +14,209 @@ void TilesetManager::setRoot(const std::string &root)
     }
 }
 
-void TilesetManager::loadTileList(const std::string &set)
+// Latest modification time of the zoom and theta folders of a tileset.
+// Adding or removing tiles changes it, writing the catalog does not.
+static int64_t scanFoldersTime(const fs::path &tileSetPath)
 {
-    ofLogNotice() << "ofApp::loadTileList()";
+    int64_t latest = 0;
+    std::error_code ec;
 
-    fs::path tileSetPath{tilesetsRoot};
-    tileSetPath /= set;
-    ofLogNotice() << "Loading " << tileSetPath;
+    for (const fs::directory_entry &zoomDir : fs::directory_iterator(tileSetPath, ec))
+    {
+        // Skips the hidden sidecar caches, such as CompressedTile's
+        if (!zoomDir.is_directory(ec) || zoomDir.path().filename().string().starts_with("."))
+            continue;
 
-    TileSet tileset;
-    tileset.name = set;
+        latest = std::max<int64_t>(latest, fs::last_write_time(zoomDir, ec).time_since_epoch().count());
 
-    // Look for saved tilelist...
+        for (const fs::directory_entry &thetaDir : fs::directory_iterator(zoomDir, ec))
+            if (thetaDir.is_directory(ec))
+                latest = std::max<int64_t>(latest, fs::last_write_time(thetaDir, ec).time_since_epoch().count());
+    }
+
+    return latest;
+}
+
+// Reads a tilelist.json written by earlier versions
+static bool importTileListJson(const fs::path &jsonPath, TileCatalog::Contents &contents)
+{
     ofxJSON j;
+    if (!j.open(jsonPath))
+        return false;
+
+    ofLog() << "Importing cached tilelist";
+    for (auto &tl : j["thetaLevels"])
+        contents.thetas.push_back(tl.asInt());
 
-    if (j.open(fs::path(tileSetPath) /= "tilelist.json"))
+    std::sort(contents.thetas.begin(), contents.thetas.end());
+
+    for (auto &zl : j["avaliableTiles"].getMemberNames())
     {
-        ofLog() << "Loading cached tilelist";
-        for (auto &tl : j["thetaLevels"])
-            tileset.thetaLevels.push_back(tl.asInt());
+        const Json::Value &levels = j["avaliableTiles"][zl];
+        if (levels.empty())
+            continue;
 
-        std::sort(tileset.thetaLevels.begin(), tileset.thetaLevels.end());
+        // Geometry is the same at every theta level, so the first one is
+        // stored for all of them
+        std::vector<std::string> thetaNames = levels.getMemberNames();
+        const Json::Value &tiles = levels[thetaNames[0]];
 
-        ofLog() << " - Loaded thetaLevels";
+        for (const std::string &t : thetaNames)
+            if (levels[t].size() != tiles.size())
+                ofLogWarning() << "Zoom " << zl << " theta " << t << " has " << levels[t].size() << " tiles, expected " << tiles.size();
 
-        for (auto &zl : j["zoomWorldSizes"].getMemberNames())
-        {
-            ofVec2f size{j["zoomWorldSizes"][zl]["x"].asFloat(), j["zoomWorldSizes"][zl]["y"].asFloat()};
-            tileset.zoomWorldSizes[ofToInt(zl)] = size;
-        }
-        ofLog() << " - Loaded zoomWorldSizes";
+        TileCatalog::ZoomRecord zoom{ofToInt(zl), j["zoomWorldSizes"][zl]["x"].asFloat(), j["zoomWorldSizes"][zl]["y"].asFloat(), 0, contents.tiles.size(), tiles.size()};
 
-        for (auto &zl : j["avaliableTiles"].getMemberNames())
-        {
-            Zoom zoom = ofToInt(zl);
-            for (auto &t : j["avaliableTiles"][zl].getMemberNames())
-            {
-                int theta = ofToInt(t);
-                for (auto &tk : j["avaliableTiles"][zl][t])
-                {
-                    std::string fp = (tileSetPath / tk["filepath"].asString());
-                    TileKey tile{zoom, tk["x"].asInt(), tk["y"].asInt(), tk["width"].asInt(), tk["height"].asInt(), theta, fp, set};
-
-                    tileset.avaliableTiles[zoom][theta].push_back(tile);
-                }
-            }
-        }
-        ofLog() << " - Loaded avaliable tiles";
+        for (auto &tk : tiles)
+            contents.tiles.push_back({tk["x"].asInt(), tk["y"].asInt(),
+                                      static_cast<uint16_t>(tk["width"].asInt()), static_cast<uint16_t>(tk["height"].asInt())});
+
+        contents.zooms.push_back(zoom);
     }
-    else
+
+    return true;
+}
+
+// Builds the catalog from the `<zoom>.0/<theta>.0/<x>x<y>x<w>x<h>.jpg` folders
+static bool scanTileDirectory(const fs::path &tileSetPath, TileCatalog::Contents &contents)
+{
+    ofDirectory tileDir{tileSetPath};
+    tileDir.listDir();
+    auto zoomLevelsDirs = tileDir.getFiles();
+
+    if (zoomLevelsDirs.size() == 0)
     {
-        // Build JSON
-        ofDirectory tileDir{tileSetPath};
-        tileDir.listDir();
-        auto zoomLevelsDirs = tileDir.getFiles();
+        ofLogWarning() << tileSetPath << " is empty";
+        return false;
+    }
 
-        if (zoomLevelsDirs.size() == 0)
-        {
-            ofLogWarning() << tileSetPath << " is empty";
-            return;
-        }
+    // get list of theta levels (as ints)
+    auto thetas = ofDirectory(tileDir.getAbsolutePath() + "/2.0/");
+    auto thetasDirs = thetas.getFiles();
 
-        j["name"] = set;
+    for (const ofFile &thetaDir : thetasDirs)
+    {
+        if (!thetaDir.isDirectory())
+            continue;
 
-        // get list of theta levels (as ints)
-        auto thetas = ofDirectory(tileDir.getAbsolutePath() + "/2.0/");
-        auto thetasDirs = thetas.getFiles();
-        tileset.thetaLevels.clear();
+        contents.thetas.push_back(ofToInt(thetaDir.getFileName()));
+    }
 
-        for (const ofFile &thetaDir : thetasDirs)
-        {
-            if (!thetaDir.isDirectory())
-                continue;
+    std::sort(contents.thetas.begin(), contents.thetas.end());
+    ofLogNotice() << "- Theta levels:";
+    std::string levels = "";
+    for (const int t : contents.thetas)
+        levels += " " + ofToString(t);
 
-            int theta = ofToInt(thetaDir.getFileName());
-            tileset.thetaLevels.push_back(theta);
-            j["thetaLevels"].append(theta);
-        }
+    ofLogNotice() << levels;
+
+    // Get all the tiles
+    for (const ofFile &zoomDir : zoomLevelsDirs)
+    {
+        if (!zoomDir.isDirectory())
+            continue;
+
+        Zoom zoom = ofToInt(zoomDir.getFileName());
+
+        ofLogNotice() << "- Zoom level " << zoom;
 
-        std::sort(tileset.thetaLevels.begin(), tileset.thetaLevels.end());
-        ofLogNotice() << "- Theta levels:";
-        std::string levels = "";
-        for (const Theta t : tileset.thetaLevels)
-            levels += " " + ofToString(t);
+        ofDirectory tiles(tileDir.getAbsolutePath() + "/" + ofToString(zoom) + ".0/0.0/");
+        tiles.allowExt("jpg");
+        tiles.listDir();
 
-        ofLogNotice() << levels;
+        auto tileFiles = tiles.getFiles();
+        ofLogNotice() << "  - Found " << ofToString(tileFiles.size()) + " tiles";
 
-        // Get all the tiles
-        for (const ofFile &zoomDir : zoomLevelsDirs)
+        ofVec2f zoomSize(0.f, 0.f);
+        uint64_t first = contents.tiles.size();
+
+        for (size_t i = 0; i < tileFiles.size(); i++)
         {
-            if (!zoomDir.isDirectory())
-                continue;
+            std::string filename = tileFiles[i].getFileName();
+            auto basename = ofSplitString(filename, ".");
+            auto components = ofSplitString(basename[0], "x", true, true);
 
-            Zoom zoom = ofToInt(zoomDir.getFileName());
+            int x = ofToInt(components[0]);
+            int y = ofToInt(components[1]);
+            int width = ofToInt(components[2]);
+            int height = ofToInt(components[3]);
 
-            ofLogNotice() << "- Zoom level " << zoom;
+            contents.tiles.push_back({x, y, static_cast<uint16_t>(width), static_cast<uint16_t>(height)});
 
-            ofDirectory tiles(tileDir.getAbsolutePath() + "/" + ofToString(zoom) + ".0/0.0/");
-            tiles.allowExt("jpg");
-            tiles.listDir();
+            zoomSize.x = std::max(zoomSize.x, static_cast<float>(x + width));
+            zoomSize.y = std::max(zoomSize.y, static_cast<float>(y + height));
+        }
 
-            auto tileFiles = tiles.getFiles();
-            ofLogNotice() << "  - Found " << ofToString(tileFiles.size()) + " tiles";
+        // Every theta folder holds the same file names, so the tiles of
+        // the 0.0 folder stand for all of them
+        contents.zooms.push_back({zoom, zoomSize.x, zoomSize.y, 0, first, contents.tiles.size() - first});
+    }
 
-            ofVec2f zoomSize(0.f, 0.f);
+    return true;
+}
 
-            for (const Theta t : tileset.thetaLevels)
-                tileset.avaliableTiles[zoom][t].reserve(tileFiles.size());
+void TilesetManager::loadTileList(const std::string &set)
+{
+    ofLogNotice() << "ofApp::loadTileList()";
 
-            for (size_t i = 0; i < tileFiles.size(); i++)
-            {
-                std::string filename = tileFiles[i].getFileName();
-                auto basename = ofSplitString(filename, ".");
-                auto components = ofSplitString(basename[0], "x", true, true);
-
-                int x = ofToInt(components[0]);
-                int y = ofToInt(components[1]);
-                int width = ofToInt(components[2]);
-                int height = ofToInt(components[3]);
-
-                for (const Theta t : tileset.thetaLevels)
-                {
-                    std::string filepath = tileDir.getAbsolutePath() + "/" + ofToString(zoom) + ".0/" + ofToString(t) + ".0/" + filename;
-                    tileset.avaliableTiles[zoom][t].emplace_back(zoom, x, y, width, height, t, filepath, set);
-                    ofxJSONElement obj;
-                    obj["x"] = x;
-                    obj["y"] = y;
-                    obj["width"] = width;
-                    obj["height"] = height;
-                    obj["t"] = t;
-                    obj["filepath"] = fs::relative(filepath, tileSetPath).c_str();
-                    j["avaliableTiles"][ofToString(zoom)][ofToString(t)].append(obj);
-                }
-
-                zoomSize.x = std::max(zoomSize.x, static_cast<float>(x + width));
-                zoomSize.y = std::max(zoomSize.y, static_cast<float>(y + height));
-            }
+    fs::path tileSetPath{tilesetsRoot};
+    tileSetPath /= set;
+    ofLogNotice() << "Loading " << tileSetPath;
+
+    auto tileset = std::make_shared<TileSet>();
+    tileset->name = set;
+    tileset->id = internTileset(set);
+
+    fs::path catalogPath = tileSetPath / "tilecatalog.bin";
+    // Where the catalog of a read-only tileset is kept
+    fs::path tempCatalogPath = fs::temp_directory_path() / ("tilecatalog-" + set + ".bin");
+    int64_t sourceTime = scanFoldersTime(tileSetPath);
+
+    auto catalog = std::make_shared<TileCatalog>();
+    if (!catalog->open(catalogPath, sourceTime) && !catalog->open(tempCatalogPath, sourceTime))
+    {
+        // Rebuild from an older JSON tilelist if it is still current,
+        // otherwise from the scan folders
+        TileCatalog::Contents contents;
+        fs::path jsonPath = tileSetPath / "tilelist.json";
+        std::error_code ec;
+        bool jsonCurrent = fs::exists(jsonPath, ec) &&
+                           fs::last_write_time(jsonPath, ec).time_since_epoch().count() >= sourceTime;
+
+        if (!(jsonCurrent && importTileListJson(jsonPath, contents)))
+        {
+            contents = {};
+            if (!scanTileDirectory(tileSetPath, contents))
+                return;
+        }
+
+        ofLogNotice() << "Saving tile catalog";
+        if (!TileCatalog::write(catalogPath, contents, sourceTime))
+        {
+            catalogPath = tempCatalogPath;
+            ofLogWarning() << "Could not write the tile catalog to " << tileSetPath << ", using " << catalogPath;
+            TileCatalog::write(catalogPath, contents, sourceTime);
+        }
 
-            tileset.zoomWorldSizes[zoom] = zoomSize;
-            j["zoomWorldSizes"][ofToString(zoom)]["x"] = zoomSize.x;
-            j["zoomWorldSizes"][ofToString(zoom)]["y"] = zoomSize.y;
+        if (!catalog->open(catalogPath, sourceTime))
+        {
+            ofLogError() << "Failed to open tile catalog " << catalogPath;
+            return;
         }
+    }
+
+    for (const int32_t t : catalog->thetas())
+        tileset->thetaLevels.push_back(t);
 
-        ofLogNotice() << "Saving tilelist JSON";
-        j.save(fs::path(tileSetPath) / "tilelist.json", true);
+    for (const TileCatalog::ZoomRecord &zoom : catalog->zooms())
+    {
+        tileset->zoomWorldSizes[zoom.zoom] = {zoom.width, zoom.height};
+        tileset->avaliableTiles[zoom.zoom] = TileLevel(catalog->tiles(zoom), zoom.zoom, tileset->id);
     }
 
+    tileset->catalog = catalog;
+    ofLog() << " - Loaded " << catalog->numTiles() << " tiles in " << catalog->zooms().size() << " zoom levels";
+
     // load POI list
     if (csv.load(fs::path(tileSetPath) / "poi.csv"))
     {
@@ -176,15 +233,50 @@ void TilesetManager::loadTileList(const std::string &set)
             float x = row.getFloat(1);
             float y = row.getFloat(2);
 
-            tileset.viewTargets.emplace_back(x, y);
+            tileset->viewTargets.emplace_back(x, y);
         }
     }
     else
         ofLogNotice() << "poi.csv not found.";
 
-    tileset.t1 = tileset.thetaLevels[0];
-    tileset.t2 = tileset.thetaLevels[1];
-    tilesets[set] = std::make_shared<TileSet>(tileset);
+    for (const auto &[zoom, tiles] : tileset->avaliableTiles)
+        tileset->tileGrids[zoom].build(tiles.records());
+
+    tileset->t1 = tileset->thetaLevels[0];
+    tileset->t2 = tileset->thetaLevels[1];
+    tilesets[set] = tileset;
+    tilesetsById[tileset->id] = tileset;
+}
+
+TilesetId TilesetManager::internTileset(const std::string &name)
+{
+    auto it = tilesetIds.find(name);
+    if (it != tilesetIds.end())
+        return it->second;
+
+    TilesetId id = static_cast<TilesetId>(tilesetNames.size());
+    tilesetIds[name] = id;
+    tilesetNames.push_back(name);
+    tilesetsById.push_back(nullptr);
+
+    return id;
+}
+
+std::string TilesetManager::tilePath(const TileKey &key) const
+{
+    const std::shared_ptr<TileSet> &tileset = tilesetsById[key.tileset];
+
+    return tilePath(tilesetsRoot / tileset->name, key);
+}
+
+std::string TilesetManager::tilePath(const fs::path &tilesetPath, const TileKey &key)
+{
+    fs::path path{tilesetPath};
+    path /= ofToString(key.zoom) + ".0";
+    path /= ofToString(key.theta) + ".0";
+    path /= std::format("{}x{}x{}x{}.jpg", key.x, key.y, key.width, key.height);
+
+    return path.string();
 }
 
 void TilesetManager::addTileSet(const std::string &name, const std::string &position = "", const std::string &alignment = "", const std::string &relativeTo = "")
@@ -355,13 +447,7 @@ void TilesetManager::updateTheta(Theta theta)
 {
     for (auto tileset : tilesetList)
     {
-        int thetaIndex = 0;
-        for (size_t i = 0; i < tileset->thetaLevels.size(); i++)
-        {
-            if (tileset->thetaLevels[i] > theta)
-                break;
-            thetaIndex = i;
-        }
+        int thetaIndex = thetaLevelIndex(*tileset, theta);
 
         // compute alpha blend
         tileset->t1 = tileset->thetaLevels[thetaIndex];
@@ -376,6 +462,20 @@ void TilesetManager::updateTheta(Theta theta)
     }
 }
 
+int TilesetManager::thetaLevelIndex(const TileSet &tileset, Theta theta)
+{
+    // Last theta level at or below `theta`
+    int thetaIndex = 0;
+    for (size_t i = 0; i < tileset.thetaLevels.size(); i++)
+    {
+        if (tileset.thetaLevels[i] > theta)
+            break;
+        thetaIndex = i;
+    }
+
+    return thetaIndex;
+}
+
 void TilesetManager::updateScale(float multiplier)
 {
     for (auto ts : tilesetList)
@@ -404,6 +504,11 @@ std::shared_ptr<TileSet> TilesetManager::operator[](const std::string &name)
     return tilesets[name];
 }
 
+std::shared_ptr<TileSet> TilesetManager::operator[](TilesetId id) const
+{
+    return tilesetsById[id];
+}
+
 bool TilesetManager::contains(const std::string &name) const
 {
     return tilesets.contains(name);
@@ -1,8 +1,11 @@
+#pragma once
+
 #include "ofMain.h"
 #include "ofxJSON.h"
 #include "ofxCsv.h"
 
 #include <filesystem>
+#include <format>
 namespace fs = std::filesystem;
 
 #include "TilesetProperties.h"
@@ -22,11 +25,17 @@ public:
     bool loadLayout(const std::string &name);
 
     void updateTheta(Theta theta);
+    static int thetaLevelIndex(const TileSet &tileset, Theta theta);
     void updateScale(float multiplier);
 
     std::shared_ptr<TileSet> getTilsetAtWorldCoords(const ofVec2f &coords, Zoom currentZoom) const;
 
+    TilesetId internTileset(const std::string &name);
+    std::string tilePath(const TileKey &key) const;
+    static std::string tilePath(const fs::path &tilesetPath, const TileKey &key);
+
     std::shared_ptr<TileSet> operator[](const std::string &name);
+    std::shared_ptr<TileSet> operator[](TilesetId id) const;
     bool contains(const std::string &name) const;
     size_t size() const;
 
@@ -36,6 +45,9 @@ public:
 
     std::unordered_map<std::string, std::shared_ptr<TileSet>> tilesets;
     std::vector<std::shared_ptr<TileSet>> tilesetList;
+    std::vector<std::shared_ptr<TileSet>> tilesetsById;
+    std::vector<std::string> tilesetNames;
+    std::unordered_map<std::string, TilesetId> tilesetIds;
     size_t tileset_index = 0;
 
     std::vector<LayoutPosition> layout;
@@ -0,0 +1,527 @@
+#pragma once
+
+#include "ofMain.h"
+#include "AsyncTextureLoader.hpp"
+#include "FrameReadbackRing.hpp"
+#include "TileAtlas.hpp"
+#include "TilesetManager.hpp"
+
+#include <deque>
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
+
+/*
+    Virtual texturing of the tile pyramid, done in shaders so it runs on
+    any GL 3.2 driver including Mesa's llvmpipe.
+
+    Pages are the cells of a level's TileGrid, which in a regular pyramid
+    hold exactly one tile. Resident pages live in the layers of one
+    physical page texture (a TileAtlas) and are uploaded straight from the
+    decoded pixels, so no texture is created per tile. Every tileset, zoom
+    and theta level has a page table, an integer texture with one texel per
+    page holding its layer plus one (0 while the page is not resident).
+    A tileset is drawn as a single quad; virtual.frag looks both theta
+    levels up in their page tables and blends them. Where a page is not
+    resident yet it falls back to the next coarser zoom level.
+
+    The pages to load come from a feedback pass: the same quads are drawn
+    into a target `feedbackScale` times smaller than the window, writing
+    the tileset and page under every pixel, and read back asynchronously.
+    The pages it found, at the current two theta levels, load first, then
+    their neighbours and the coarser level's pages under them. A frame is
+    complete once every page whose rotated bounds reach the screen is
+    resident; the coarser level does not hold it up.
+
+    Feedback texels store the tileset id plus one in 8 bits and the page
+    column and row in 12 bits each, which limits a layout to 254 tilesets
+    and levels to 4096 pages a side.
+*/
+class VirtualTexture
+{
+public:
+    static constexpr int feedbackScale = 8;
+
+    bool setup()
+    {
+        if (!shader.load("virtual.vert", "virtual.frag") || !feedbackShader.load("virtual.vert", "virtual_feedback.frag"))
+            return false;
+
+        atlas.onEvict = [this](const TileKey &key, int)
+        {
+            auto it = tables.find(tableId(key.tileset, key.zoom, key.theta));
+            if (it != tables.end())
+                it->second.set(key, 0);
+        };
+        return true;
+    }
+
+    // Pages of every level of `tilesetManager` are addressable
+    static bool supports(const TilesetManager &tilesetManager)
+    {
+        if (tilesetManager.tilesetList.size() > 254)
+            return false;
+
+        for (const auto &tileset : tilesetManager.tilesetList)
+        {
+            for (const auto &[zoom, grid] : tileset->tileGrids)
+            {
+                if (grid.getColumns() > 4096 || grid.getRows() > 4096 || !grid.isRegular(tileset->avaliableTiles.at(zoom).records()))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // Physical pages of `width` x `height`, as many as fit in `maxBytes`
+    void allocate(int width, int height, size_t maxBytes)
+    {
+        tables.clear();
+        sampled.clear();
+        atlas.allocate(width, height, maxBytes);
+    }
+
+    bool isReady() const
+    {
+        return shader.isLoaded() && feedbackShader.isLoaded() && atlas.isAllocated();
+    }
+
+    /*
+        Requests the missing pages the latest feedback pass found on screen
+        at the tilesets' current theta levels, and those of the next
+        coarser level under them. Returns true once every page of the
+        current level `isVisible` holds on screen is resident; `viewBounds`
+        (in world coordinates of `zoom`) only limits the pages tested.
+    */
+    bool update(const TilesetManager &tilesetManager, AsyncTextureLoader &loader, Zoom zoom, const ofRectangle &viewBounds,
+                const std::function<bool(const ofRectangle &, ofVec2f)> &isVisible)
+    {
+        readback.collect([this](const ofPixels &pixels)
+                         { collect(pixels); });
+
+        // Only pages of this frame are protected from eviction
+        atlas.nextFrame();
+
+        // Feedback of another level addresses other pages
+        if (sampledZoom == zoom)
+            requestSampled(tilesetManager, loader, zoom);
+
+        needed = 0;
+        missing = 0;
+        for (const auto &tileset : tilesetManager.tilesetList)
+        {
+            ofRectangle local(viewBounds.getPosition() - tileset->offset, viewBounds.width, viewBounds.height);
+            forEachPage(*tileset, zoom, local, [&](const TileKey &key, uint64_t)
+                        {
+                            if (!isVisible(ofRectangle(key.x, key.y, key.width, key.height), tileset->offset))
+                                return;
+
+                            needed++;
+                            if (atlas.find(key) < 0)
+                                missing++; });
+        }
+
+        // A view needing more pages than there are slots never completes
+        overCapacity = needed > static_cast<size_t>(atlas.getNumSlots());
+        if (overCapacity)
+        {
+            if (!warnedCapacity)
+                ofLogWarning("VirtualTexture") << needed << " pages on screen but " << atlas.getNumSlots() << " slots, raise tile_atlas_mb";
+            warnedCapacity = true;
+            return true;
+        }
+        warnedCapacity = false;
+
+        return missing == 0;
+    }
+
+    // The last update() found more pages on screen than the atlas holds,
+    // so the frame is drawn with holes
+    bool isOverCapacity() const
+    {
+        return overCapacity;
+    }
+
+    // Renders the feedback pass of `tilesets` and queues its readback
+    void renderFeedback(const std::vector<std::shared_ptr<TileSet>> &tilesets, Zoom zoom, const ofMatrix4x4 &viewMatrix)
+    {
+        int width = std::max(ofGetWidth() / feedbackScale, 1);
+        int height = std::max(ofGetHeight() / feedbackScale, 1);
+        if (feedback.getWidth() != width || feedback.getHeight() != height)
+            feedback.allocate(width, height, GL_RGBA);
+
+        // Texels are ids, they must not be blended
+        feedback.begin();
+        ofClear(0, 0, 0, 0);
+        ofDisableAlphaBlending();
+        ofPushMatrix();
+        ofScale(1.f / feedbackScale);
+        ofMultMatrix(viewMatrix);
+        feedbackShader.begin();
+
+        for (const auto &tileset : tilesets)
+        {
+            auto grid = tileset->tileGrids.find(zoom);
+            if (grid == tileset->tileGrids.end())
+                continue;
+
+            feedbackShader.setUniform1i("tileset", tileset->id);
+            drawQuad(feedbackShader, *tileset, grid->second, zoom);
+        }
+
+        feedbackShader.end();
+        ofPopMatrix();
+        ofEnableAlphaBlending();
+        feedback.end();
+
+        feedbackZooms.push_back(zoom);
+        readback.read(feedback, [this](const ofPixels &pixels)
+                      { collect(pixels); });
+    }
+
+    void draw(const TileSet &tileset, Zoom zoom, const ofMatrix4x4 &viewMatrix)
+    {
+        auto grid = tileset.tileGrids.find(zoom);
+        if (grid == tileset.tileGrids.end())
+            return;
+
+        PageTable &tableA = table(tileset, zoom, tileset.t1);
+        PageTable &tableB = table(tileset, zoom, tileset.t2);
+        tableA.upload();
+        tableB.upload();
+
+        // Without a coarser level the current one stands in for itself
+        Zoom coarse = zoom * 2;
+        glm::vec2 scale = coarseScale(tileset, zoom, coarse);
+        if (scale.x <= 0.f)
+        {
+            coarse = zoom;
+            scale = {1.f, 1.f};
+        }
+        const TileGrid &coarseGrid = tileset.tileGrids.at(coarse);
+        PageTable &coarseA = table(tileset, coarse, tileset.t1);
+        PageTable &coarseB = table(tileset, coarse, tileset.t2);
+        coarseA.upload();
+        coarseB.upload();
+
+        ofPushMatrix();
+        ofMultMatrix(viewMatrix);
+        shader.begin();
+        shader.setUniformTexture("atlas", GL_TEXTURE_2D_ARRAY, atlas.getTextureId(), 1);
+        shader.setUniformTexture("pageTableA", GL_TEXTURE_2D, tableA.texture, 2);
+        shader.setUniformTexture("pageTableB", GL_TEXTURE_2D, tableB.texture, 3);
+        shader.setUniformTexture("coarseTableA", GL_TEXTURE_2D, coarseA.texture, 4);
+        shader.setUniformTexture("coarseTableB", GL_TEXTURE_2D, coarseB.texture, 5);
+        shader.setUniform2f("coarseScale", scale);
+        shader.setUniform2f("coarseGridOrigin", coarseGrid.getOrigin());
+        shader.setUniform1f("coarsePageSize", static_cast<float>(coarseGrid.getCellSize()));
+        shader.setUniform2i("coarseNumPages", coarseGrid.getColumns(), coarseGrid.getRows());
+        shader.setUniform2f("slotSize", atlas.getSlotSize());
+        shader.setUniform1f("alpha", tileset.blendAlpha);
+        drawQuad(shader, tileset, grid->second, zoom);
+        shader.end();
+        ofPopMatrix();
+    }
+
+    // Distinct pages in the latest feedback
+    size_t numSampled() const
+    {
+        return sampled.size();
+    }
+
+    // Pages under the view at either theta level, and how many of those
+    // are not resident
+    size_t numNeeded() const
+    {
+        return needed;
+    }
+
+    size_t numMissing() const
+    {
+        return missing;
+    }
+
+    TileAtlas atlas;
+
+private:
+    struct PageTable
+    {
+        GLuint texture = 0;
+        int columns = 0;
+        int rows = 0;
+        int cellSize = 1;
+        glm::vec2 origin;
+        std::vector<uint16_t> entries;
+        bool dirty = true;
+
+        PageTable() = default;
+        PageTable(const PageTable &) = delete;
+        PageTable &operator=(const PageTable &) = delete;
+
+        ~PageTable()
+        {
+            if (texture != 0)
+                glDeleteTextures(1, &texture);
+        }
+
+        void set(const TileKey &key, uint16_t entry)
+        {
+            int column = static_cast<int>((key.x - origin.x) / cellSize);
+            int row = static_cast<int>((key.y - origin.y) / cellSize);
+            if (column < 0 || row < 0 || column >= columns || row >= rows)
+                return;
+
+            entries[row * columns + column] = entry;
+            dirty = true;
+        }
+
+        void upload()
+        {
+            if (!dirty)
+                return;
+
+            if (texture == 0)
+            {
+                glGenTextures(1, &texture);
+                glBindTexture(GL_TEXTURE_2D, texture);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, columns, rows, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+            }
+            else
+                glBindTexture(GL_TEXTURE_2D, texture);
+
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, columns, rows, GL_RED_INTEGER, GL_UNSIGNED_SHORT, entries.data());
+            glBindTexture(GL_TEXTURE_2D, 0);
+            dirty = false;
+        }
+    };
+
+    static uint64_t tableId(TilesetId tileset, int zoom, int theta)
+    {
+        return (static_cast<uint64_t>(tileset) << 32) | (static_cast<uint64_t>(static_cast<uint16_t>(zoom)) << 16) | static_cast<uint16_t>(theta);
+    }
+
+    PageTable &table(const TileSet &tileset, Zoom zoom, Theta theta)
+    {
+        PageTable &table = tables[tableId(tileset.id, zoom, static_cast<int16_t>(theta))];
+        if (table.entries.empty())
+        {
+            const TileGrid &grid = tileset.tileGrids.at(zoom);
+            table.columns = std::max(grid.getColumns(), 1);
+            table.rows = std::max(grid.getRows(), 1);
+            table.cellSize = grid.getCellSize();
+            table.origin = grid.getOrigin();
+            table.entries.assign(static_cast<size_t>(table.columns) * table.rows, 0);
+        }
+        return table;
+    }
+
+    // Calls `visit(key, page)` for the pages of `zoom` overlapping `local`,
+    // in the tileset's own coordinates, at its current theta levels.
+    // `page` identifies the page as feedback texels do.
+    template <typename Visit>
+    static void forEachPage(const TileSet &tileset, Zoom zoom, const ofRectangle &local, Visit &&visit)
+    {
+        auto grid = tileset.tileGrids.find(zoom);
+        auto level = tileset.avaliableTiles.find(zoom);
+        if (grid == tileset.tileGrids.end() || level == tileset.avaliableTiles.end())
+            return;
+
+        glm::vec2 origin = grid->second.getOrigin();
+        int cellSize = grid->second.getCellSize();
+        std::span<const CatalogTile> tiles = level->second.records();
+
+        grid->second.query(local, [&](uint32_t index)
+                           {
+                               const CatalogTile &tile = tiles[index];
+                               if (!local.intersects(ofRectangle(tile.x, tile.y, tile.width, tile.height)))
+                                   return;
+
+                               uint64_t column = static_cast<uint64_t>((tile.x - origin.x) / cellSize);
+                               uint64_t row = static_cast<uint64_t>((tile.y - origin.y) / cellSize);
+                               uint64_t page = (static_cast<uint64_t>(tileset.id) << 32) | (row << 16) | column;
+
+                               visit(level->second.key(index, tileset.t1), page);
+                               if (tileset.t2 != tileset.t1)
+                                   visit(level->second.key(index, tileset.t2), page); });
+    }
+
+    /*
+        Requests the sampled pages that are not resident, and the pages
+        around them: feedback texels are `feedbackScale` pixels apart, so a
+        sliver of a page at the edge of a sampled one may have no texel of
+        its own. Sampled pages rank above their neighbours, the dominant
+        theta level above the other and the coarser level's stand ins
+        below all.
+    */
+    void requestSampled(const TilesetManager &tilesetManager, AsyncTextureLoader &loader, Zoom zoom)
+    {
+        wanted.clear();
+        for (uint64_t page : sampled)
+        {
+            int column = static_cast<int>(page & 0xffff);
+            int row = static_cast<int>((page >> 16) & 0xffff);
+            for (int dy = -1; dy <= 1; dy++)
+            {
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    if (column + dx < 0 || row + dy < 0)
+                        continue;
+
+                    uint64_t neighbour = (page & ~0xffffffffull) | (static_cast<uint64_t>(row + dy) << 16) | static_cast<uint64_t>(column + dx);
+                    float &priority = wanted[neighbour];
+                    priority = std::max(priority, dx == 0 && dy == 0 ? 4.f : 2.f);
+                }
+            }
+        }
+
+        for (const auto &tileset : tilesetManager.tilesetList)
+        {
+            auto grid = tileset->tileGrids.find(zoom);
+            auto level = tileset->avaliableTiles.find(zoom);
+            if (grid == tileset->tileGrids.end() || level == tileset->avaliableTiles.end())
+                continue;
+
+            Theta dominantTheta = tileset->blendAlpha < 0.5f ? tileset->t1 : tileset->t2;
+            Zoom coarse = zoom * 2;
+            glm::vec2 scale = coarseScale(*tileset, zoom, coarse);
+            std::span<const CatalogTile> tiles = level->second.records();
+
+            for (const auto &[page, priority] : wanted)
+            {
+                if ((page >> 32) != tileset->id)
+                    continue;
+
+                int64_t index = grid->second.tileAt(static_cast<int>(page & 0xffff), static_cast<int>((page >> 16) & 0xffff));
+                if (index < 0)
+                    continue;
+
+                for (Theta theta : {tileset->t1, tileset->t2})
+                {
+                    TileKey key = level->second.key(index, theta);
+                    if (atlas.find(key) < 0)
+                        request(tilesetManager, loader, *tileset, key, priority + (theta == dominantTheta ? 1.f : 0.f));
+                    if (tileset->t2 == tileset->t1)
+                        break;
+                }
+
+                // Stand ins are only checked, not found: they are not
+                // counted as used, so they age out of the atlas before the
+                // pages of the current level
+                if (scale.x <= 0.f)
+                    continue;
+
+                const CatalogTile &tile = tiles[index];
+                const TileGrid &coarseGrid = tileset->tileGrids.at(coarse);
+                glm::vec2 coarseOrigin = coarseGrid.getOrigin();
+                float coarseCellSize = static_cast<float>(coarseGrid.getCellSize());
+                int column = static_cast<int>(std::floor(((tile.x + tile.width * 0.5f) * scale.x - coarseOrigin.x) / coarseCellSize));
+                int row = static_cast<int>(std::floor(((tile.y + tile.height * 0.5f) * scale.y - coarseOrigin.y) / coarseCellSize));
+                int64_t coarseIndex = coarseGrid.tileAt(column, row);
+                if (coarseIndex < 0)
+                    continue;
+
+                for (Theta theta : {tileset->t1, tileset->t2})
+                {
+                    TileKey key = tileset->avaliableTiles.at(coarse).key(coarseIndex, theta);
+                    if (!atlas.contains(key))
+                        request(tilesetManager, loader, *tileset, key, 1.f);
+                    if (tileset->t2 == tileset->t1)
+                        break;
+                }
+            }
+        }
+    }
+
+    // Scale from the coordinates of `zoom` to those of `coarse`, 0 if
+    // the tileset has no such level
+    static glm::vec2 coarseScale(const TileSet &tileset, Zoom zoom, Zoom coarse)
+    {
+        auto size = tileset.zoomWorldSizes.find(zoom);
+        auto coarseSize = tileset.zoomWorldSizes.find(coarse);
+        if (size == tileset.zoomWorldSizes.end() || coarseSize == tileset.zoomWorldSizes.end() ||
+            !tileset.tileGrids.count(coarse) || size->second.x <= 0.f || size->second.y <= 0.f)
+            return {0.f, 0.f};
+
+        return {coarseSize->second.x / size->second.x, coarseSize->second.y / size->second.y};
+    }
+
+    // Tables exist before their first page arrives
+    void request(const TilesetManager &tilesetManager, AsyncTextureLoader &loader, const TileSet &tileset, const TileKey &key, float priority)
+    {
+        table(tileset, key.zoom, key.theta);
+        loader.requestPixels(tilesetManager.tilePath(key), priority, [this, key](const std::string &, const ofPixels &pixels)
+                             { map(key, pixels); });
+    }
+
+    // Uploads a page that arrived from the loader and points its table at it
+    void map(const TileKey &key, const ofPixels &pixels)
+    {
+        auto it = tables.find(tableId(key.tileset, key.zoom, key.theta));
+        if (it == tables.end())
+            return;
+
+        int slot = atlas.slot(key, pixels);
+        if (slot >= 0)
+            it->second.set(key, static_cast<uint16_t>(slot + 1));
+    }
+
+    void drawQuad(ofShader &target, const TileSet &tileset, const TileGrid &grid, Zoom zoom)
+    {
+        auto size = tileset.zoomWorldSizes.find(zoom);
+        if (size == tileset.zoomWorldSizes.end())
+            return;
+
+        target.setUniform2f("offset", tileset.offset);
+        target.setUniform2f("gridOrigin", grid.getOrigin());
+        target.setUniform1f("pageSize", static_cast<float>(grid.getCellSize()));
+        target.setUniform2i("numPages", grid.getColumns(), grid.getRows());
+
+        ofFill();
+        ofSetColor(255);
+        ofDrawRectangle(tileset.offset.x, tileset.offset.y, size->second.x, size->second.y);
+    }
+
+    // Decodes a feedback frame into the set of sampled pages. Frames come
+    // back in the order they were rendered.
+    void collect(const ofPixels &pixels)
+    {
+        if (!feedbackZooms.empty())
+        {
+            sampledZoom = feedbackZooms.front();
+            feedbackZooms.pop_front();
+        }
+
+        sampled.clear();
+        const uint8_t *data = pixels.getData();
+        size_t channels = pixels.getNumChannels();
+        for (size_t i = 0; i < pixels.getWidth() * pixels.getHeight(); i++, data += channels)
+        {
+            if (data[0] == 0)
+                continue;
+
+            uint64_t tileset = data[0] - 1;
+            uint64_t column = data[1] | ((data[3] & 0x0f) << 8);
+            uint64_t row = data[2] | ((data[3] >> 4) << 8);
+            sampled.insert((tileset << 32) | (row << 16) | column);
+        }
+    }
+
+    ofShader shader;
+    ofShader feedbackShader;
+    std::unordered_map<uint64_t, PageTable> tables;
+
+    ofFbo feedback;
+    FrameReadbackRing readback{2};
+
+    std::deque<Zoom> feedbackZooms;
+    std::unordered_set<uint64_t> sampled;
+    Zoom sampledZoom = 0;
+    std::unordered_map<uint64_t, float> wanted;
+    size_t needed = 0;
+    size_t missing = 0;
+    bool overCapacity = false;
+    bool warnedCapacity = false;
+};
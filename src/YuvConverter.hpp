@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// BT.709 coefficients scaled to limited range, in 16.16 fixed point
+namespace bt709
+{
+    constexpr int fix(double v)
+    {
+        return static_cast<int>(v * 65536.0 + (v < 0 ? -0.5 : 0.5));
+    }
+
+    constexpr double kr = 0.2126;
+    constexpr double kb = 0.0722;
+    constexpr double kg = 1.0 - kr - kb;
+    constexpr double yScale = 219.0 / 255.0;
+    constexpr double cScale = 224.0 / 255.0;
+
+    constexpr int yr = fix(kr * yScale);
+    constexpr int yg = fix(kg * yScale);
+    constexpr int yb = fix(kb * yScale);
+    constexpr int ur = fix(-kr / (2.0 * (1.0 - kb)) * cScale);
+    constexpr int ug = fix(-kg / (2.0 * (1.0 - kb)) * cScale);
+    constexpr int ub = fix(0.5 * cScale);
+    constexpr int vr = fix(0.5 * cScale);
+    constexpr int vg = fix(-kg / (2.0 * (1.0 - kr)) * cScale);
+    constexpr int vb = fix(-kb / (2.0 * (1.0 - kr)) * cScale);
+}
+
+/*
+    Converts 8 bit RGB or RGBA frames to planar YUV 4:2:0 (I420) with the
+    BT.709 matrix in limited ("TV") range, which is what the encoder wants
+    anyway. Done before the frame is handed to ffmpeg, the conversion leaves
+    half the bytes to write and takes swscale's single threaded pass off the
+    encoder.
+
+    Frames are split into horizontal bands of row pairs, one per thread; the
+    calling thread converts the first band itself. The inner loops are plain
+    fixed point arithmetic over contiguous rows so the compiler vectorizes
+    them for whatever instruction set the build targets.
+*/
+class YuvConverter
+{
+public:
+    YuvConverter(size_t numThreads = std::max(1u, std::thread::hardware_concurrency() / 2))
+    {
+        numBands = std::max<size_t>(numThreads, 1);
+        for (size_t i = 1; i < numBands; i++)
+            workers.emplace_back(&YuvConverter::work, this, i);
+    }
+
+    YuvConverter(const YuvConverter &) = delete;
+    YuvConverter &operator=(const YuvConverter &) = delete;
+
+    ~YuvConverter()
+    {
+        {
+            std::lock_guard lock(mutex);
+            quit = true;
+        }
+        start.notify_all();
+
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+
+    // Bytes of an I420 frame of the given size
+    static size_t frameBytes(size_t width, size_t height)
+    {
+        size_t chromaWidth = (width + 1) / 2;
+        size_t chromaHeight = (height + 1) / 2;
+        return width * height + 2 * chromaWidth * chromaHeight;
+    }
+
+    // Converts into three planes with the given strides
+    void convert(const uint8_t *src, size_t width, size_t height, size_t channels, uint8_t *const planes[3], const int strides[3])
+    {
+        job = {src, width, height, channels, {planes[0], planes[1], planes[2]}, {strides[0], strides[1], strides[2]}};
+
+        {
+            std::lock_guard lock(mutex);
+            pending = workers.size();
+            generation++;
+        }
+        start.notify_all();
+
+        convertBand(0);
+
+        std::unique_lock lock(mutex);
+        done.wait(lock, [this]
+                  { return pending == 0; });
+    }
+
+    // Converts into one contiguous I420 buffer of frameBytes() bytes
+    void convert(const uint8_t *src, size_t width, size_t height, size_t channels, uint8_t *dst)
+    {
+        int chromaWidth = static_cast<int>((width + 1) / 2);
+        size_t chromaHeight = (height + 1) / 2;
+        uint8_t *planes[3] = {dst, dst + width * height, dst + width * height + chromaWidth * chromaHeight};
+        int strides[3] = {static_cast<int>(width), chromaWidth, chromaWidth};
+        convert(src, width, height, channels, planes, strides);
+    }
+
+    size_t getNumThreads() const
+    {
+        return numBands;
+    }
+
+private:
+    struct Job
+    {
+        const uint8_t *src;
+        size_t width;
+        size_t height;
+        size_t channels;
+        uint8_t *planes[3];
+        int strides[3];
+    };
+
+    void work(size_t band)
+    {
+        uint64_t seen = 0;
+        while (true)
+        {
+            {
+                std::unique_lock lock(mutex);
+                start.wait(lock, [&]
+                           { return quit || generation != seen; });
+                if (quit)
+                    return;
+                seen = generation;
+            }
+
+            convertBand(band);
+
+            {
+                std::lock_guard lock(mutex);
+                pending--;
+            }
+            done.notify_one();
+        }
+    }
+
+    void convertBand(size_t band)
+    {
+        size_t rowPairs = (job.height + 1) / 2;
+        size_t first = rowPairs * band / numBands;
+        size_t last = rowPairs * (band + 1) / numBands;
+
+        for (size_t pair = first; pair < last; pair++)
+        {
+            size_t y0 = pair * 2;
+            size_t y1 = std::min(y0 + 1, job.height - 1);
+            const uint8_t *row0 = job.src + y0 * job.width * job.channels;
+            const uint8_t *row1 = job.src + y1 * job.width * job.channels;
+
+            uint8_t *luma0 = job.planes[0] + y0 * job.strides[0];
+            uint8_t *luma1 = job.planes[0] + y1 * job.strides[0];
+            uint8_t *u = job.planes[1] + pair * job.strides[1];
+            uint8_t *v = job.planes[2] + pair * job.strides[2];
+
+            // A compile time pixel stride is what lets the loops vectorize
+            if (job.channels == 4)
+                convertRows<4>(row0, row1, luma0, luma1, u, v, y1 != y0);
+            else
+                convertRows<3>(row0, row1, luma0, luma1, u, v, y1 != y0);
+        }
+    }
+
+    template <size_t c>
+    void convertRows(const uint8_t *row0, const uint8_t *row1, uint8_t *luma0, uint8_t *luma1, uint8_t *u, uint8_t *v, bool twoRows) const
+    {
+        convertLuma<c>(row0, luma0);
+        if (twoRows)
+            convertLuma<c>(row1, luma1);
+        convertChroma<c>(row0, row1, u, v);
+    }
+
+    template <size_t c>
+    void convertLuma(const uint8_t *__restrict src, uint8_t *__restrict dst) const
+    {
+        using namespace bt709;
+        for (size_t x = 0; x < job.width; x++)
+        {
+            int r = src[x * c];
+            int g = src[x * c + 1];
+            int b = src[x * c + 2];
+            dst[x] = static_cast<uint8_t>((yr * r + yg * g + yb * b + (16 << 16) + (1 << 15)) >> 16);
+        }
+    }
+
+    // Chroma of each 2x2 block, from the sum of its four pixels
+    template <size_t c>
+    void convertChroma(const uint8_t *__restrict row0, const uint8_t *__restrict row1, uint8_t *__restrict u, uint8_t *__restrict v) const
+    {
+        using namespace bt709;
+        const size_t pairs = job.width / 2;
+
+        for (size_t x = 0; x < pairs; x++)
+        {
+            size_t i = x * 2 * c;
+            int r = row0[i] + row0[i + c] + row1[i] + row1[i + c];
+            int g = row0[i + 1] + row0[i + c + 1] + row1[i + 1] + row1[i + c + 1];
+            int b = row0[i + 2] + row0[i + c + 2] + row1[i + 2] + row1[i + c + 2];
+            u[x] = static_cast<uint8_t>((ur * r + ug * g + ub * b + (128 << 18) + (1 << 17)) >> 18);
+            v[x] = static_cast<uint8_t>((vr * r + vg * g + vb * b + (128 << 18) + (1 << 17)) >> 18);
+        }
+
+        // An odd last column is its own block, counted twice
+        if (job.width % 2)
+        {
+            size_t i = pairs * 2 * c;
+            int r = (row0[i] + row1[i]) * 2;
+            int g = (row0[i + 1] + row1[i + 1]) * 2;
+            int b = (row0[i + 2] + row1[i + 2]) * 2;
+            u[pairs] = static_cast<uint8_t>((ur * r + ug * g + ub * b + (128 << 18) + (1 << 17)) >> 18);
+            v[pairs] = static_cast<uint8_t>((vr * r + vg * g + vb * b + (128 << 18) + (1 << 17)) >> 18);
+        }
+    }
+
+    std::vector<std::thread> workers;
+    size_t numBands = 1;
+
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    uint64_t generation = 0;
+    size_t pending = 0;
+    bool quit = false;
+
+    Job job{};
+};
@@ -1,8 +1,10 @@
 #include "ofMain.h"
 #include "ofApp.h"
+#include "EncoderBenchmark.hpp"
+#include "TileIngest.hpp"
 
 //========================================================================
-int main()
+int main(int argc, char *argv[])
 {
     ofGLFWWindowSettings settings;
 
@@ -10,8 +12,50 @@ int main()
     settings.windowMode = OF_WINDOW;
     settings.setGLVersion(3, 2);
 
+    auto app = make_shared<ofApp>();
+
+    // --render <project> renders the project's sequence offline and quits
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--render" && i + 1 < argc)
+        {
+            app->offline = true;
+            app->offlineProject = argv[++i];
+        }
+        // --segments <K> renders in K parallel processes, which get
+        // --frames <first>:<end> --output <name>
+        else if (arg == "--segments" && i + 1 < argc)
+            app->segmentCount = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--frames" && i + 1 < argc)
+            std::sscanf(argv[++i], "%d:%d", &app->segmentFirstFrame, &app->segmentEndFrame);
+        else if (arg == "--output" && i + 1 < argc)
+            app->segmentName = argv[++i];
+        // --benchmark-encoder [frames] compares the recorder's encoding
+        // paths at the window size and quits
+        else if (arg == "--benchmark-encoder")
+        {
+            int frames = i + 1 < argc ? std::atoi(argv[i + 1]) : 0;
+            return runEncoderBenchmark(settings.getWidth(), settings.getHeight(), frames > 0 ? frames : 300);
+        }
+        // --ingest <folder>... transcodes the tiles of the tilesets in or
+        // below the folders to compressed sidecars and quits
+        else if (arg == "--ingest")
+        {
+            std::vector<std::filesystem::path> folders;
+            while (i + 1 < argc && std::string(argv[i + 1]).rfind("--", 0) != 0)
+                folders.push_back(argv[++i]);
+            return runTileIngest(folders);
+        }
+    }
+
+    // Frames are rendered into an FBO, so the window only has to provide
+    // a GL context of the same size
+    if (app->offline)
+        settings.visible = false;
+
     auto window = ofCreateWindow(settings);
 
-    ofRunApp(window, make_shared<ofApp>());
+    ofRunApp(window, app);
     ofRunMainLoop();
 }
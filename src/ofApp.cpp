@@ -4,7 +4,7 @@
 void ofApp::setup()
 {
     ofSetWindowTitle("As Gems in Metal");
-    ofSetVerticalSync(true);
+    ofSetVerticalSync(!offline);
     ofSetEscapeQuitsApp(false);
 
     // Setup shader stuff
@@ -15,6 +15,15 @@ void ofApp::setup()
     else
         ofLogNotice() << "Shader loaded successfully";
 
+    if (!tileShader.load("blend.vert", "tile.frag"))
+        ofLogError() << "Tile shader not loaded, using the fbo render path";
+
+    if (!tileBatch.setup())
+        ofLogError() << "Tiles shader not loaded, using the single pass render path";
+
+    if (!virtualTexture.setup())
+        ofLogError() << "Virtual texture shaders not loaded";
+
     // Load config
     toml::table tbl;
     try
@@ -46,10 +55,34 @@ void ofApp::setup()
 
     std::optional<float> fps = tbl["recording_fps"].value<float>();
 
+    int defaultLoaderThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    int loaderThreads = std::max(1, tbl["loader_threads"].value_or(defaultLoaderThreads));
+    uploadBudgetMs = tbl["upload_budget_ms"].value_or(uploadBudgetMs);
+    int cacheBudgetMB = tbl["cache_budget_mb"].value_or(1024);
+    prefetchSeconds = tbl["prefetch_seconds"].value_or(prefetchSeconds);
+    recorderBackend = tbl["recorder_backend"].value_or(recorderBackend);
+    renderPath = tbl["render_path"].value_or(renderPath);
+    tileAtlasMB = tbl["tile_atlas_mb"].value_or(tileAtlasMB);
+    bool compressedTiles = tbl["compressed_tiles"].value_or(false);
+    pathTraceBinary = tbl["path_trace_binary"].value_or(pathTraceBinary);
+    cacheSecondary.setMaxBytes(static_cast<size_t>(cacheBudgetMB) << 20);
+
     ofLogNotice() << "Loading config.toml:";
     ofLogNotice() << " - scans_root: " << rootFolder.value_or("<empty>");
     ofLogNotice() << " - projects_root: " << projectRootFolder.value_or("<empty>");
     ofLogNotice() << " - recording_fps: " << fps.value();
+    ofLogNotice() << " - loader_threads: " << loaderThreads;
+    ofLogNotice() << " - upload_budget_ms: " << uploadBudgetMs;
+    ofLogNotice() << " - cache_budget_mb: " << cacheBudgetMB;
+    ofLogNotice() << " - prefetch_seconds: " << prefetchSeconds;
+    ofLogNotice() << " - recorder_backend: " << recorderBackend;
+    ofLogNotice() << " - render_path: " << renderPath;
+    ofLogNotice() << " - tile_atlas_mb: " << tileAtlasMB;
+    ofLogNotice() << " - compressed_tiles: " << compressedTiles;
+    ofLogNotice() << " - path_trace_binary: " << pathTraceBinary;
+
+    loader.compressedTiles = compressedTiles;
+    loader.setup(loaderThreads);
 
     tilesetManager.setRoot(scanRoot);
     projectsDir.assign(projectRootFolder.value());
@@ -69,6 +102,8 @@ void ofApp::setup()
     maxMovingTime = 30.f;
     drillSpeed = 0.4f;
 
+    fboPool.resize(ofGetWidth(), ofGetHeight());
+
     plane.set(ofGetWidth(), ofGetHeight());
     plane.setScale(1, -1, 1);
     plane.setPosition(0, ofGetHeight(), 0);
@@ -78,7 +113,7 @@ void ofApp::setup()
     rotationAngle.warmUp = 0.f;
     rotationAngle.epsilon = 0.001f;
     currentZoomSmooth.maxStep = 0.5f;
-    currentZoomSmooth.warmUp = 3.f;
+    currentZoomSmooth.warmUp = zoomWarmUp;
     currentZoomSmooth.epsilon = 0.0001f;
     currentTheta.warmUp = 0.0f;
 
@@ -109,12 +144,42 @@ void ofApp::setup()
     // parameters["orientation"] = &targetOrientation;
     parameters["k"] = &k;
     parameters["d"] = &d;
+
+    if (offline)
+    {
+        // Render the project's sequence as fast as tiles load and frames
+        // encode, then quit
+        ofLogNotice() << "Offline render of " << offlineProject;
+        ofSetFrameRate(0);
+        showDebug = false;
+        hideGui = true;
+
+        loadProject(offlineProject);
+
+        if (segmentCount > 1)
+        {
+            renderSegments();
+            ofExit();
+            return;
+        }
+
+        startRecording();
+    }
 }
 
 //--------------------------------------------------------------
 void ofApp::update()
 {
-    loader.dispatchMainCallbacks(32);
+    loader.uploadResults(uploadBudgetMs);
+
+    if (stillExport.valid() && stillExport.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        if (stillExport.get())
+            ofLogNotice() << "Finished rendering";
+        else
+            ofLogError() << "Rendering the overview failed";
+        deepZoom.reset();
+    }
 
     if (currentTileSet == nullptr && tilesetManager.tilesetList.size())
         currentTileSet = tilesetManager.tilesetList[0];
@@ -125,21 +190,30 @@ void ofApp::update()
         return;
     }
 
-    numFramesQueued = ffmpegRecorder.m_Frames.size();
-
-    if (numFramesQueued > 50)
+    if (trackPlaying)
     {
-        waitForFrames = true;
-        return;
+        if (trackFrame + 1 < track.size())
+            seekTrack(trackFrame + 1);
+        else
+        {
+            trackPlaying = false;
+            if (recording)
+                stopRecording();
+        }
     }
-    else if (waitForFrames && numFramesQueued == 0)
-        waitForFrames = false;
-
-    if (waitForFrames || rendering)
-        return;
+    else
+        stepSimulation(1.f / recordingFps);
 
-    float dt = 1.f / recordingFps;
+    frameReady = updateCaches();
+}
 
+void ofApp::stepSimulation(float dt)
+{
+    /*
+        Advances camera, animations and the sequence by one fixed step.
+        Does not touch the tile caches, so it runs the same whether frames
+        are drawn in a window or offline.
+    */
     if (centerZoom)
         zoomCenterWorld = screenToWorld(screenCenter);
 
@@ -283,8 +357,6 @@ void ofApp::update()
             }
         }
     }
-
-    frameReady = updateCaches();
 }
 
 //--------------------------------------------------------------
@@ -300,14 +372,68 @@ void ofApp::draw()
     float elapsedTime = ofGetElapsedTimef();
     lastFrameTime = elapsedTime;
 
+    bool virtualTiles = renderPath == "virtual" && virtualTexture.isReady();
+    bool batched = renderPath == "batched" && tileBatch.isReady() && tileShader.isLoaded();
+    bool singlePass = (batched || renderPath == "single_pass") && tileShader.isLoaded();
+
+    if (virtualTiles)
+        virtualTexture.renderFeedback(tilesetManager.tilesetList, currentZoom, viewMatrix);
+
+    // Tilesets off screen give their render targets back to the pool
+    ofRectangle viewBounds = getViewBoundsWorld();
     for (const auto &tileset : tilesetManager.tilesetList)
+    {
+        auto size = tileset->zoomWorldSizes.find(currentZoom);
+        bool onScreen = size != tileset->zoomWorldSizes.end() && viewBounds.intersects(ofRectangle(tileset->offset, size->second.x, size->second.y));
+
+        if (virtualTiles || singlePass || !onScreen)
+        {
+            fboPool.release(tileset->fbos);
+            continue;
+        }
+
+        if (!tileset->fbos)
+            tileset->fbos = fboPool.acquire();
         drawTiles(tileset);
+    }
 
     fboFinal.begin();
     ofBackground(0, 0, 0);
 
+    if (batched)
+    {
+        tileBatch.begin();
+        tileFallbacks.clear();
+    }
+
     for (const auto &tileset : tilesetManager.tilesetList)
-        tileset->fboMain.draw(0, 0);
+    {
+        if (virtualTiles)
+            virtualTexture.draw(*tileset, currentZoom, viewMatrix);
+        else if (singlePass)
+            drawTilesSinglePass(*tileset, batched);
+        else if (tileset->fbos)
+            tileset->fbos->main.draw(0, 0);
+    }
+
+    // Tilesets do not overlap, so their tiles go out in one call after all,
+    // followed by the ones that did not fit the atlas
+    if (batched)
+    {
+        tileBatch.draw(viewMatrix);
+        drawTilePairs(tileFallbacks);
+    }
+
+    // Overlays go over every tile (the fbo path draws its own)
+    if ((virtualTiles || singlePass) && showDebug && !recording)
+    {
+        for (const auto &tileset : tilesetManager.tilesetList)
+        {
+            if (singlePass)
+                drawTileOutlines(*tileset);
+            drawViewTargets(tileset);
+        }
+    }
 
     ofVec2f cursor(static_cast<float>(ofGetMouseX()), static_cast<float>(ofGetMouseY()));
     const float margin = 6.f;
@@ -319,7 +445,7 @@ void ofApp::draw()
         {margin, margin},
     };
 
-    if (showDebug && !recording && !rendering)
+    if (showDebug && !recording)
     {
         ofPushMatrix();
         ofMultMatrix(viewMatrix);
@@ -378,78 +504,67 @@ void ofApp::draw()
             projectName, frameCount, time, currentZoomSmooth.getValue(), tilesetName, eventName);
 
         ofDrawBitmapStringHighlight(renderInfo, 0, ofGetHeight() - (2 * 8 * 1.7f - 1));
-
-        if (waitForFrames)
-        {
-            std::string msg = std::format("  PAUSED FOR RENDER TO CATCH UP ({}) ", numFramesQueued);
-            ofDrawBitmapStringHighlight(msg, (ofGetWidth() - (msg.size() * 8)) / 2, ofGetHeight() / 2 - 4);
-        }
     }
 
     fboFinal.end();
-    fboFinal.draw(0, 0);
-
-    if (recording && frameReady && !waitForFrames)
-    {
-        // save fboFinal to video buffer
-        fboFinal.readToPixels(framePixels);
-
-        // sleep to make sure data is written
-        ofSleepMillis(50);
 
-        if (framePixels.getWidth() > 0 && framePixels.getHeight() > 0)
-        {
-            ffmpegRecorder.addSingleFrame(framePixels);
+    if (!offline)
+        fboFinal.draw(0, 0);
 
-            // if (time >= lastPathT + recordPathDt)
-            // {
-            std::shared_ptr<TileSet> tileset = tilesetManager.getTilsetAtWorldCoords(screenToWorld(screenCenter), currentZoom);
+    auto encodeFrame = [this](const ofPixels &pixels)
+    { ffmpegRecorder.addSingleFrame(pixels); };
 
-            // Distance at zoomLevel 32
-            float dist = 0.f;
-            std::string next = "";
-            if (currentTileSet)
-            {
-                next = currentTileSet->name;
-                ofVec2f poiPos = globalToWorld(currentTileSet->viewTargets[currentPOI], currentTileSet);
-                float currentDistance = poiPos.distance(currentView.offsetWorld);
-                float multiplier = std::powf(2.f, currentZoomLevel);
+    if (recording && frameReady)
+    {
+        // save fboFinal to video buffer. The frame reaches the encoder a
+        // frame or two later, once its readback has finished on the GPU.
+        // Handing it over blocks while the encoder's frame queue is full
+        frameReadback.read(fboFinal, encodeFrame);
 
-                // convert to distance at zoomLevel 0
-                dist = currentDistance * multiplier;
+        // if (time >= lastPathT + recordPathDt)
+        // {
+        std::shared_ptr<TileSet> tileset = tilesetManager.getTilsetAtWorldCoords(screenToWorld(screenCenter), currentZoom);
 
-                // scale to zoomLevel 32
-                dist /= 32.f;
-            }
+        // Distance at zoomLevel 32
+        float dist = 0.f;
+        TilesetId next = PathTraceWriter::noTileset;
+        if (currentTileSet)
+        {
+            next = currentTileSet->id;
+            ofVec2f poiPos = globalToWorld(currentTileSet->viewTargets[currentPOI], currentTileSet);
+            float currentDistance = poiPos.distance(currentView.offsetWorld);
+            float multiplier = std::powf(2.f, currentZoomLevel);
 
-            ofVec2f centerGlobal = worldToGlobal(screenToWorld(screenCenter), tileset);
-            ofVec2f leftGlobal = worldToGlobal(screenToWorld({0.f, ofGetHeight() / 2.f}), tileset);
-            ofVec2f rightGlobal = worldToGlobal(screenToWorld({static_cast<float>(ofGetWidth()), ofGetHeight() / 2.f}), tileset);
+            // convert to distance at zoomLevel 0
+            dist = currentDistance * multiplier;
 
-            std::ofstream outfile;
+            // scale to zoomLevel 32
+            dist /= 32.f;
+        }
 
-            fs::path tracePath{recordingDir};
-            tracePath /= (recordingFileName + "_path.csv");
-            outfile.open(tracePath, std::ofstream::out | std::ios_base::app);
+        ofVec2f centerGlobal = worldToGlobal(screenToWorld(screenCenter), tileset);
+        ofVec2f leftGlobal = worldToGlobal(screenToWorld({0.f, ofGetHeight() / 2.f}), tileset);
+        ofVec2f rightGlobal = worldToGlobal(screenToWorld({static_cast<float>(ofGetWidth()), ofGetHeight() / 2.f}), tileset);
 
-            // ofVec2f screenToWorld()
+        pathTrace.add({time, frameCount,
+                       centerGlobal.x, centerGlobal.y,
+                       leftGlobal.x, leftGlobal.y,
+                       rightGlobal.x, rightGlobal.y,
+                       currentView.theta, currentZoomSmooth.getValue(), rotationAngle.getValue(),
+                       tileset->id, next, currentPOI, dist});
 
-            // t,frame,x,y,eftX,leftY,rightX,rightY,theta,zoomLevel,rotation,currentTileset,nextTileset,poi,distance
-            outfile << ofToString(time) << "," << frameCount << ","
-                    << ofToString(centerGlobal.x) << "," << ofToString(centerGlobal.y) << ","
-                    << ofToString(leftGlobal.x) << "," << ofToString(leftGlobal.y) << ","
-                    << ofToString(rightGlobal.x) << "," << ofToString(rightGlobal.y) << ","
-                    << ofToString(currentView.theta) << "," << ofToString(currentZoomSmooth.getValue()) << "," << rotationAngle.getValue() << ","
-                    << tileset->name << "," << next << "," << currentPOI << "," << dist
-                    << std::endl;
+        // lastPathT += recordPathDt;
+        // }
 
-            // lastPathT += recordPathDt;
-            // }
+        frameCount++;
 
-            frameCount++;
-        }
+        // A part of a segmented render ends where the next one starts
+        if (segmentEndFrame > 0 && frameCount >= segmentEndFrame)
+            stopRecording();
     }
 
+    frameReadback.collect(encodeFrame);
+
     if (recording)
     {
         ofNoFill();
@@ -498,92 +613,34 @@ void ofApp::draw()
             prevPoiPos.set(pos);
         }
 
-        if (!rendering)
-        {
-            std::string coordinates = std::format(
-                "Offset: {:.2f}, {:.2f}, ZoomCenter {:.2f}, {:.2f}, rotationAngle {:.2f}",
-                currentView.offsetWorld.x, currentView.offsetWorld.y, zoomCenterWorld.x, zoomCenterWorld.y, rotationAngle.getValue());
-
-            ofDrawBitmapStringHighlight(coordinates, 0, ofGetHeight() - 40);
-
-            ofVec2f cursorWorld = screenToWorld(cursor);
-            ofVec2f cursorGlobal = worldToGlobal(cursorWorld, currentTileSet);
-
-            std::shared_ptr<TileSet> hoveredTileset = tilesetManager.getTilsetAtWorldCoords(cursorWorld, currentZoom);
-            std::string hoveredTilesetName = "<null>";
-            if (hoveredTileset)
-                hoveredTilesetName = hoveredTileset->name;
-
-            std::string status = std::format(
-                "Zoom: {:.2f} (ZoomLevel {}, Scale: {:.2f}), Theta: {:.2f} \nCache: MAIN {}, SECONDARY {} (cache misses: {}), frameReady {:6}, drill {}, t {:.2f}, currentTileset: {} Global mouse {:.6f},{:.6f} (Tileset under cursor: {})",
-                currentZoomSmooth.getValue(), currentZoomLevel, currentView.scale, currentView.theta, cacheMain.size(), cacheSecondary.size(), cacheMisses, frameReady, drill, time, tilesetName, cursorGlobal.x, cursorGlobal.y, hoveredTilesetName);
-
-            ofDrawBitmapStringHighlight(status, 0, ofGetHeight() - 20);
-
-            // std::string viewMatrixStr = std::format(
-            //     "┏{:9.3f} {:9.3f} {:9.3f} {:9.3f}┓\n│{:9.3f} {:9.3f} {:9.3f} {:9.3f}│\n│{:9.3f} {:9.3f} {:9.3f} {:9.3f}│\n┗{:9.3f} {:9.3f} {:9.3f} {:9.3f}┛",
-            //     viewMatrix._mat[0][0], viewMatrix._mat[1][0], viewMatrix._mat[2][0], viewMatrix._mat[3][0],
-            //     viewMatrix._mat[0][1], viewMatrix._mat[1][1], viewMatrix._mat[2][1], viewMatrix._mat[3][1],
-            //     viewMatrix._mat[0][2], viewMatrix._mat[1][2], viewMatrix._mat[2][2], viewMatrix._mat[3][2],
-            //     viewMatrix._mat[0][3], viewMatrix._mat[1][3], viewMatrix._mat[2][3], viewMatrix._mat[3][3]);
-
-            // ofDrawBitmapStringHighlight(viewMatrixStr, ofGetWidth() - 360, 20);
-        }
-    }
-
-    if (rendering && frameReady)
-    {
-        static int x = 0;
-        static int y = 0;
-
-        // ofRectangle bounds = getLayoutBounds();
-        ofPixels pixels;
+        std::string coordinates = std::format(
+            "Offset: {:.2f}, {:.2f}, ZoomCenter {:.2f}, {:.2f}, rotationAngle {:.2f}",
+            currentView.offsetWorld.x, currentView.offsetWorld.y, zoomCenterWorld.x, zoomCenterWorld.y, rotationAngle.getValue());
 
-        ofGetGLRenderer()->saveFullViewport(pixels);
+        ofDrawBitmapStringHighlight(coordinates, 0, ofGetHeight() - 40);
 
-        ofLog() << " frame " << pixels.getWidth() << "x" << pixels.getHeight() << " at (" << x << ", " << y << ")" << " pixel format: " << pixels.getPixelFormat();
-        pasteInto(screenshot, pixels, x, y);
+        ofVec2f cursorWorld = screenToWorld(cursor);
+        ofVec2f cursorGlobal = worldToGlobal(cursorWorld, currentTileSet);
 
-        // move onto next
-        if (layoutBounds.getBottom() < y + ofGetHeight())
-        {
-            // reached bottom
-            if (layoutBounds.getRight() < x + ofGetWidth())
-            {
-                // reached end
-                rendering = false;
-                ofLog() << "screenshot pixelFormat: " << screenshot.getPixelFormat();
+        std::shared_ptr<TileSet> hoveredTileset = tilesetManager.getTilsetAtWorldCoords(cursorWorld, currentZoom);
+        std::string hoveredTilesetName = "<null>";
+        if (hoveredTileset)
+            hoveredTilesetName = hoveredTileset->name;
 
-                fs::path saveDir{projectsDir};
-                saveDir /= "overview.png";
-                ofSaveImage(screenshot, saveDir);
-                ofLog() << "Finished rendering";
+        std::string status = std::format(
+            "Zoom: {:.2f} (ZoomLevel {}, Scale: {:.2f}), Theta: {:.2f} \nCache: MAIN {}, SECONDARY {}, {}/{} MB (cache misses: {}), Loader: {} pending, {} cancelled ({} workers), frameReady {:6}, drill {}, t {:.2f}, currentTileset: {} Global mouse {:.6f},{:.6f} (Tileset under cursor: {})",
+            currentZoomSmooth.getValue(), currentZoomLevel, currentView.scale, currentView.theta, cacheMain.size(), cacheSecondary.size(), (cacheMainBytes + cacheSecondary.getUsedBytes()) >> 20, cacheSecondary.getMaxBytes() >> 20, cacheMisses, loader.numPending(), loader.numCancelled.load(), loader.numWorkers(), frameReady, drill, time, tilesetName, cursorGlobal.x, cursorGlobal.y, hoveredTilesetName);
 
-                x = 0;
-                y = 0;
-            }
-            else
-            {
-                // jump to top, move right
-                y = 0;
-                x += ofGetWidth();
-                currentView.offsetWorld.y = topLayoutWorld + screenSizeWorld.y / 2.f;
-                currentView.offsetWorld.x += screenSizeWorld.x;
-                calculateViewMatrix();
-            }
-        }
-        else
-        {
-            // move down
-            currentView.offsetWorld += ofVec2f(0, screenSizeWorld.y);
-            y += ofGetHeight();
-            calculateViewMatrix();
-        }
+        ofDrawBitmapStringHighlight(status, 0, ofGetHeight() - 20);
 
-        frameReady = false;
-        ofSleepMillis(100);
+        // std::string viewMatrixStr = std::format(
+        //     "┏{:9.3f} {:9.3f} {:9.3f} {:9.3f}┓\n│{:9.3f} {:9.3f} {:9.3f} {:9.3f}│\n│{:9.3f} {:9.3f} {:9.3f} {:9.3f}│\n┗{:9.3f} {:9.3f} {:9.3f} {:9.3f}┛",
+        //     viewMatrix._mat[0][0], viewMatrix._mat[1][0], viewMatrix._mat[2][0], viewMatrix._mat[3][0],
+        //     viewMatrix._mat[0][1], viewMatrix._mat[1][1], viewMatrix._mat[2][1], viewMatrix._mat[3][1],
+        //     viewMatrix._mat[0][2], viewMatrix._mat[1][2], viewMatrix._mat[2][2], viewMatrix._mat[3][2],
+        //     viewMatrix._mat[0][3], viewMatrix._mat[1][3], viewMatrix._mat[2][3], viewMatrix._mat[3][3]);
 
-        return;
+        // ofDrawBitmapStringHighlight(viewMatrixStr, ofGetWidth() - 360, 20);
     }
 
     if (!hideGui || quitting)
@@ -593,6 +650,11 @@ void ofApp::draw()
 //--------------------------------------------------------------
 void ofApp::exit()
 {
+    if (stillExport.valid())
+    {
+        cancelExport();
+        stillExport.wait();
+    }
     ffmpegRecorder.stop();
     loader.stop();
 }
@@ -735,13 +797,12 @@ void ofApp::windowResized(int w, int h)
     plane.set(ofGetWidth(), ofGetHeight());
     plane.setPosition(ofGetWidth() / 2, ofGetHeight() / 2, 0);
 
+    plane.mapTexCoords(0, 0, w, h);
+
+    // Targets are allocated again at the new size when next needed
+    fboPool.resize(w, h);
     for (auto tileset : tilesetManager.tilesetList)
-    {
-        tileset->fboA.allocate(w, h, GL_RGBA);
-        tileset->fboB.allocate(w, h, GL_RGBA);
-        tileset->fboMain.allocate(w, h, GL_RGBA);
-        plane.mapTexCoordsFromTexture(tileset->fboMain.getTexture());
-    }
+        fboPool.release(tileset->fbos);
 
     screenRectangle = ofRectangle(0.f, 0.f, static_cast<float>(ofGetWidth()), static_cast<float>(ofGetHeight()));
     screenCenter = screenRectangle.getBottomRight() / 2.f;
@@ -801,9 +862,41 @@ void ofApp::loadProject(const std::string &name)
     sequencePath = fs::path{projectDir};
     sequencePath /= "sequence.json";
 
+    // Loading replaces the tilesets, hand their targets back first
+    for (auto &[setName, tileset] : tilesetManager.tilesets)
+        fboPool.release(tileset->fbos);
+
     tilesetManager.loadLayout(layoutPath);
     tilesetManager.computeLayout(currentZoom);
 
+    // Atlas slots fit the largest tile of the project
+    int tileWidth = 0;
+    int tileHeight = 0;
+    for (const auto &tileset : tilesetManager.tilesetList)
+    {
+        for (const auto &[zoom, tiles] : tileset->avaliableTiles)
+        {
+            for (const CatalogTile &tile : tiles.records())
+            {
+                tileWidth = std::max<int>(tileWidth, tile.width);
+                tileHeight = std::max<int>(tileHeight, tile.height);
+            }
+        }
+    }
+    if (renderPath == "virtual" && !VirtualTexture::supports(tilesetManager))
+    {
+        ofLogWarning() << "Tile levels are not regular grids, using the batched render path";
+        renderPath = "batched";
+    }
+
+    if (tileWidth > 0 && tileHeight > 0)
+    {
+        if (renderPath == "virtual")
+            virtualTexture.allocate(tileWidth, tileHeight, static_cast<size_t>(tileAtlasMB) << 20);
+        else
+            tileBatch.atlas.allocate(tileWidth, tileHeight, static_cast<size_t>(tileAtlasMB) << 20);
+    }
+
     ofVec2f centerWorld(0, 0);
 
     if (tilesetManager.tilesetList.size())
@@ -815,6 +908,18 @@ void ofApp::loadProject(const std::string &name)
 
     loadSequence(sequencePath);
 
+    // A compiled track is only valid for the sequence and layout it was
+    // compiled from
+    fs::path trackPath{projectDir};
+    trackPath /= "track.bin";
+    std::error_code ec;
+    auto trackTime = fs::last_write_time(trackPath, ec);
+    if (!ec && trackTime >= fs::last_write_time(sequencePath, ec) && trackTime >= fs::last_write_time(layoutPath, ec) && track.load(trackPath))
+        ofLogNotice() << "Loaded track: " << track.size() << " frames, " << formatTime(track.getDuration());
+    else
+        track.clear();
+    trackFrame = 0;
+
     currentView.offsetWorld.set(centerWorld);
     cameraTargetWorld.set(centerWorld);
     calculateViewMatrix();
@@ -825,16 +930,16 @@ void ofApp::loadProject(const std::string &name)
 bool ofApp::isVisible(const ofRectangle &worldRect, ofVec2f offset)
 {
     // Get all 4 corners of the world rectangle
-    std::vector<ofVec2f> worldCorners = {
+    const std::array<ofVec2f, 4> worldCorners = {{
         {worldRect.x + offset.x, worldRect.y + offset.y},
         {worldRect.x + worldRect.width + offset.x, worldRect.y + offset.y},
         {worldRect.x + worldRect.width + offset.x, worldRect.y + worldRect.height + offset.y},
-        {worldRect.x + offset.x, worldRect.y + worldRect.height + offset.y}};
+        {worldRect.x + offset.x, worldRect.y + worldRect.height + offset.y}}};
 
     // Transform to screen space
-    std::vector<ofVec4f> screenCorners;
-    for (const auto &pt : worldCorners)
-        screenCorners.push_back(ofVec4f(pt.x, pt.y, 0.f, 1.f) * viewMatrix);
+    std::array<ofVec4f, 4> screenCorners;
+    for (size_t i = 0; i < worldCorners.size(); i++)
+        screenCorners[i] = ofVec4f(worldCorners[i].x, worldCorners[i].y, 0.f, 1.f) * viewMatrix;
 
     // Compute screen-space bounding box of the transformed rectangle
     float minX = screenCorners[0].x, maxX = screenCorners[0].x;
@@ -859,6 +964,17 @@ bool ofApp::isVisible(const TileKey &key, ofVec2f offset)
     return isVisible({(float)key.x, (float)key.y, (float)key.width, (float)key.height}, offset);
 }
 
+ofRectangle ofApp::getViewBoundsWorld()
+{
+    // Axis aligned bounds of the (possibly rotated) screen in world space
+    ofRectangle bounds(screenToWorld(screenRectangle.getTopLeft()), 0.f, 0.f);
+    bounds.growToInclude(screenToWorld(screenRectangle.getTopRight()));
+    bounds.growToInclude(screenToWorld(screenRectangle.getBottomRight()));
+    bounds.growToInclude(screenToWorld(screenRectangle.getBottomLeft()));
+
+    return bounds;
+}
+
 ofRectangle ofApp::getLayoutBounds()
 {
     // ofLog() << __FUNCTION__ << " currentZoom " << currentZoom;
@@ -910,20 +1026,46 @@ bool ofApp::updateCaches()
 {
     bool frameReady = true;
 
+    // Requests not renewed below are dropped before they are decoded
+    loader.nextFrame();
+
+    // Pages are loaded as the feedback pass finds them, the cache tiers
+    // below are not used
+    if (renderPath == "virtual" && virtualTexture.isReady())
+    {
+        bool ready = virtualTexture.update(tilesetManager, loader, currentZoom, getViewBoundsWorld(), [this](const ofRectangle &rect, ofVec2f offset)
+                                           { return isVisible(rect, offset); });
+
+        // A recording would go on with holes in every frame
+        if (recording && virtualTexture.isOverCapacity())
+        {
+            ofLogError() << "The view needs " << virtualTexture.numNeeded() << " tile pages but the atlas holds " << virtualTexture.atlas.getNumSlots() << ", raise tile_atlas_mb. Recording stopped";
+            stopRecording();
+            if (offline)
+                ofExit(1);
+            return false;
+        }
+        return ready;
+    }
+
     // 1. Demote from MAIN
     for (auto it = cacheMain.begin(); it != cacheMain.end();)
     {
-        TileKey key = it->first;
+        const TileKey &key = it->first;
+        const std::shared_ptr<TileSet> &tileset = tilesetManager[key.tileset];
 
-        Theta t1 = tilesetManager[key.tileset]->t1;
-        Theta t2 = tilesetManager[key.tileset]->t2;
+        Theta t1 = tileset->t1;
+        Theta t2 = tileset->t2;
 
         if (
             (key.zoom != currentZoom || key.zoom != currentZoom - 1) ||
             (key.theta != t1 && key.theta != t2) ||
-            (!isVisible(key, tilesetManager[key.tileset]->offset)))
+            (!isVisible(key, tileset->offset)))
         {
-            cacheSecondary.put(key, it->second);
+            cacheMainBytes -= textureBytes(it->second);
+            cacheSecondary.setReservedBytes(cacheMainBytes);
+            cacheSecondary.put(it->first, it->second);
+            residentTiles.erase(it->first);
             it = cacheMain.erase(it);
         }
         else
@@ -931,6 +1073,8 @@ bool ofApp::updateCaches()
     }
 
     // 2. Check which tiles are needed
+    ofRectangle viewBounds = getViewBoundsWorld();
+
     for (auto tileset : tilesetManager.tilesetList)
     {
         // 2.1 Skip if tileset is not visible
@@ -939,43 +1083,69 @@ bool ofApp::updateCaches()
         if (!isVisible(tilesetBounds, tileset->offset))
             continue;
 
-        // 2.2 Check tiles for current and next theta level
-        const auto &v1 = tileset->avaliableTiles.at(currentZoom).at(tileset->t1);
-        const auto &v2 = tileset->avaliableTiles.at(currentZoom).at(tileset->t2);
+        // 2.2 Check tiles for current and next theta level, only looking at
+        // the grid cells under the view
+        ofRectangle localBounds{viewBounds.getPosition() - tileset->offset, viewBounds.width, viewBounds.height};
 
-        for (const auto &vec : {std::cref(v1), std::cref(v2)})
-        {
-            for (const TileKey &key : vec.get())
+        const TileLevel &tiles = tileset->avaliableTiles.at(currentZoom);
+
+        tileset->tileGrids.at(currentZoom).query(localBounds, [&](uint32_t index)
+                                                 {
+            // Visibility only depends on the geometry shared by both thetas
+            TileKey geometry = tiles.key(index, tileset->t1);
+            if (!isVisible(geometry, tileset->offset))
+                return;
+
+            for (Theta theta : {tileset->t1, tileset->t2})
             {
-                if (cacheMain.count(key))
-                    continue;
+                TileKey key = tiles.key(index, theta);
 
-                if (!isVisible(key, tileset->offset))
+                if (cacheMain.count(key))
                     continue;
 
                 ofTexture tile;
                 if (cacheSecondary.get(key, tile))
                 {
-                    cacheMain[key] = tile;
                     cacheSecondary.erase(key);
+                    putMain(key, tile);
                 }
                 else
                 {
                     frameReady = false;
-                    loader.requestLoad(key.filepath, [this, key](const std::string &, ofImage tile)
+
+                    ofVec2f tileCenter = worldToScreen(ofVec2f(key.x + key.width / 2.f, key.y + key.height / 2.f) + tileset->offset);
+                    float centerDistance = tileCenter.distance(screenCenter) / screenCenter.length();
+
+                    loader.requestLoad(tilesetManager.tilePath(key), tilePriority(key, *tileset, true, centerDistance), [this, key](const std::string &, ofTexture &tile)
                                        { cacheMisses++;
-                                 cacheMain[key] = tile.getTexture(); });
+                                 putMain(key, tile); });
                 }
-            }
-        }
+            } });
     }
 
+    // 3. Queue what the sequence will need next, behind everything above
+    prefetchSequence();
+
     return frameReady;
 }
 
+void ofApp::putMain(const TileKey &key, const ofTexture &tile)
+{
+    auto it = cacheMain.find(key);
+    if (it != cacheMain.end())
+        cacheMainBytes -= textureBytes(it->second);
+
+    cacheMain[key] = tile;
+    cacheMainBytes += textureBytes(tile);
+    residentTiles.insert(key);
+
+    // Tiles on screen are never evicted, the secondary tier gives way instead
+    cacheSecondary.setReservedBytes(cacheMainBytes);
+}
+
 void ofApp::preloadZoom(int level)
 {
-    if (level < maxZoomLevel || level > minZoomLevel)
+    if (headless || level < maxZoomLevel || level > minZoomLevel)
         return;
 
     float multiplier = std::powf(2.f, (level - currentZoomLevel));
@@ -985,6 +1155,8 @@ void ofApp::preloadZoom(int level)
     float left = currentView.viewWorld.getLeft() / multiplier;
     float top = currentView.viewWorld.getTop() / multiplier;
     float bottom = currentView.viewWorld.getBottom() / multiplier;
+    ofVec2f viewCenter = currentView.viewWorld.getCenter() / multiplier;
+    float viewRadius = ofVec2f(right - left, bottom - top).length() / 2.f;
 
     for (auto tileset : tilesetManager.tilesetList)
     {
@@ -996,30 +1168,126 @@ void ofApp::preloadZoom(int level)
 
         int preloadCount = 0;
 
-        const auto &v1 = tileset->avaliableTiles.at(zoom).at(tileset->t1);
-        const auto &v2 = tileset->avaliableTiles.at(zoom).at(tileset->t2);
+        ofRectangle localBounds{left - tileset->offset.x, top - tileset->offset.y, right - left, bottom - top};
 
-        for (const auto &vec : {std::cref(v1), std::cref(v2)})
-        {
-            for (const TileKey &key : vec.get())
+        const TileLevel &tiles = tileset->avaliableTiles.at(zoom);
+
+        tileset->tileGrids.at(zoom).query(localBounds, [&](uint32_t index)
+                                          {
+            TileKey geometry = tiles.key(index, tileset->t1);
+            if (geometry.x + tileset->offset.x >= right ||
+                (geometry.x + geometry.width + tileset->offset.x) <= left ||
+                geometry.y + tileset->offset.y >= bottom ||
+                (geometry.y + geometry.height + tileset->offset.y) <= top)
+                return;
+
+            for (Theta theta : {tileset->t1, tileset->t2})
             {
-                if (key.x + tileset->offset.x >= right ||
-                    (key.x + key.width + tileset->offset.x) <= left ||
-                    key.y + tileset->offset.y >= bottom ||
-                    (key.y + key.height + tileset->offset.y) <= top)
-                    continue;
+                TileKey key = tiles.key(index, theta);
 
                 if (!cacheSecondary.contains(key, false))
                 {
-                    loader.requestLoad(key.filepath, [this, key](const std::string &, ofImage tile)
-                                       { cacheSecondary.put(key, tile.getTexture()); });
+                    ofVec2f tileCenter = ofVec2f(key.x + key.width / 2.f, key.y + key.height / 2.f) + tileset->offset;
+                    float centerDistance = tileCenter.distance(viewCenter) / viewRadius;
+
+                    loader.requestLoad(tilesetManager.tilePath(key), tilePriority(key, *tileset, false, centerDistance), [this, key](const std::string &, ofTexture &tile)
+                                       { cacheSecondary.put(key, tile); });
                     preloadCount++;
                 }
-            }
+            } });
+    }
+}
+
+void ofApp::prefetchSequence()
+{
+    prefetchRequests = 0;
+
+    if (headless || !sequencePlaying || prefetchSeconds <= 0.f || sequenceStep < 0 || sequenceStep >= (int)sequence.size())
+        return;
+
+    SequencePrefetcher::CameraState start{currentView.offsetWorld * currentZoom, currentZoomSmooth.getValue(), currentTheta.getValue(),
+                                          currentZoomSmooth.getTargetValue(), currentZoomSmooth.getElapsedTime()};
+    SequencePrefetcher::Parameters params{flyHeight, drillTime, thetaSpeed, minMovingTime, maxMovingTime, zoomAdjust,
+                                          zoomSpeed, zoomWarmUp, currentZoomSmooth.maxStep, recordingFps, cycleTheta};
+
+    const auto &keyframes = prefetcher.predict(sequence, sequenceStep, time - stepStartTime, start, params, currentZoom, prefetchSeconds);
+
+    // Rotation is not predicted, so cover the circle around the screen
+    float screenRadius = screenCenter.length();
+
+    // Latest first, so a tile needed at several keyframes ends up with the
+    // priority of the earliest one
+    for (auto kf = keyframes.rbegin(); kf != keyframes.rend(); ++kf)
+    {
+        int level = std::clamp(static_cast<int>(std::floor(kf->zoom)), maxZoomLevel, minZoomLevel);
+        Zoom zoom = static_cast<int>(std::floor(std::powf(2, level)));
+
+        // Keyframes are in full resolution pixels, tiles in pixels of `zoom`
+        ofVec2f center = kf->center / zoom;
+        float radius = screenRadius * std::powf(2.f, kf->zoom) / zoom;
+        Theta theta = std::fmodf(kf->theta + 180.f, 180.f);
+
+        // Below every visible and preload request
+        float priority = -1.f - kf->time / prefetchSeconds;
+
+        for (auto tileset : tilesetManager.tilesetList)
+        {
+            auto grid = tileset->tileGrids.find(zoom);
+            if (grid == tileset->tileGrids.end() || tileset->thetaLevels.empty())
+                continue;
+
+            ofVec2f offset = tileset->offset * currentZoom / zoom;
+            ofRectangle localBounds{center.x - radius - offset.x, center.y - radius - offset.y, 2.f * radius, 2.f * radius};
+
+            int thetaIndex = TilesetManager::thetaLevelIndex(*tileset, theta);
+            Theta t1 = tileset->thetaLevels[thetaIndex];
+            Theta t2 = tileset->thetaLevels[(thetaIndex + 1) % tileset->thetaLevels.size()];
+
+            const TileLevel &tiles = tileset->avaliableTiles.at(zoom);
+
+            grid->second.query(localBounds, [&](uint32_t index)
+                               {
+                TileKey geometry = tiles.key(index, t1);
+                if (geometry.x >= localBounds.getRight() ||
+                    geometry.x + geometry.width <= localBounds.getLeft() ||
+                    geometry.y >= localBounds.getBottom() ||
+                    geometry.y + geometry.height <= localBounds.getTop())
+                    return;
+
+                for (Theta t : {t1, t2})
+                {
+                    TileKey key = tiles.key(index, t);
+
+                    if (cacheMain.count(key) || cacheSecondary.contains(key))
+                        continue;
+
+                    loader.requestLoad(tilesetManager.tilePath(key), priority, [this, key](const std::string &, ofTexture &tile)
+                                       { cacheSecondary.put(key, tile); });
+                    prefetchRequests++;
+                } });
         }
     }
 }
 
+float ofApp::tilePriority(const TileKey &key, const TileSet &tileset, bool visible, float centerDistance) const
+{
+    // Ordered: visible now > current zoom > current theta levels >
+    // closest to the center. Both levels of the blend rank alike, so a
+    // pair is not drawn half loaded.
+    float priority = 1.f - std::clamp(centerDistance, 0.f, 1.f);
+
+    if (key.theta == static_cast<int16_t>(tileset.t1) || key.theta == static_cast<int16_t>(tileset.t2))
+        priority += 1.f;
+
+    if (key.zoom == currentZoom)
+        priority += 2.f;
+
+    if (visible)
+        priority += 4.f;
+
+    return priority;
+}
+
 void ofApp::drawTiles(std::shared_ptr<TileSet> tileset)
 {
     numberVisibleTiles = 0;
@@ -1028,73 +1296,198 @@ void ofApp::drawTiles(std::shared_ptr<TileSet> tileset)
     ofSetColor(255);
     ofSetLineWidth(1.f);
 
-    tileset->fboA.begin();
+    tileset->fbos->a.begin();
     ofClear(0.0f, 0.0f);
-    tileset->fboA.end();
+    tileset->fbos->a.end();
 
-    tileset->fboB.begin();
+    tileset->fbos->b.begin();
     ofClear(0.0f, 0.0f);
-    tileset->fboB.end();
+    tileset->fbos->b.end();
 
-    for (const auto &[key, tile] : cacheMain)
+    for (Theta theta : {tileset->t1, tileset->t2})
     {
-        if (tileset->name != key.tileset)
-            continue;
-
         // draw thetas on different fbos
-        if (key.theta == tileset->t1)
-            tileset->fboA.begin();
-        else if (key.theta == tileset->t2)
-            tileset->fboB.begin();
-        else
-            continue;
+        ofFbo &target = theta == tileset->t1 ? tileset->fbos->a : tileset->fbos->b;
+        for (const TileKey &key : residentTiles.get(tileset->id, theta))
+        {
+            target.begin();
+            ofPushMatrix();
+            ofMultMatrix(viewMatrix);
+            ofSetColor(255);
+            cacheMain.at(key).draw(key.x + tileset->offset.x, key.y + tileset->offset.y);
 
-        ofPushMatrix();
-        ofMultMatrix(viewMatrix);
-        ofSetColor(255);
-        tile.draw(key.x + tileset->offset.x, key.y + tileset->offset.y);
+            if (showDebug && !recording)
+            {
+                ofSetColor(255, 0, 0);
+                ofSetLineWidth(3.f);
+                ofDrawRectangle(key.x + tileset->offset.x, key.y + tileset->offset.y, key.width, key.height);
+            }
+            ofPopMatrix();
+            target.end();
 
-        if (showDebug && !recording)
-        {
-            ofSetColor(255, 0, 0);
-            ofSetLineWidth(3.f);
-            ofDrawRectangle(key.x + tileset->offset.x, key.y + tileset->offset.y, key.width, key.height);
+            numberVisibleTiles++;
         }
-        ofPopMatrix();
-
-        if (key.theta == tileset->t1)
-            tileset->fboA.end();
-        else
-            tileset->fboB.end();
 
-        numberVisibleTiles++;
+        // A tileset with a single theta level has t1 == t2
+        if (tileset->t1 == tileset->t2)
+            break;
     }
 
-    tileset->fboMain.begin();
+    tileset->fbos->main.begin();
     ofClear(0.f, 0.f);
     blendShader.begin();
-    blendShader.setUniformTexture("texA", tileset->fboA.getTexture(), 1);
-    blendShader.setUniformTexture("texB", tileset->fboB.getTexture(), 2);
+    blendShader.setUniformTexture("texA", tileset->fbos->a.getTexture(), 1);
+    blendShader.setUniformTexture("texB", tileset->fbos->b.getTexture(), 2);
     blendShader.setUniform1f("alpha", tileset->blendAlpha);
     plane.draw();
 
     blendShader.end();
 
     if (showDebug && !recording)
+        drawViewTargets(tileset);
+    tileset->fbos->main.end();
+}
+
+void ofApp::drawTilesSinglePass(const TileSet &tileset, bool batched)
+{
+    /*
+        Draws every resident tile of `tileset` once, straight into the
+        current target, with its t1 and t2 textures bound together and
+        mixed by blendAlpha in tile.frag. A tile whose other theta level
+        is not loaded yet is drawn on its own.
+
+        When `batched`, tiles are only added to tileBatch, which draws them
+        all at once at the end of the frame. A full atlas is flushed and
+        the tile added again. Tiles the atlas cannot hold, such as
+        compressed ones, go straight to tileFallbacks, drawn after the
+        batch, as do those that still do not fit.
+    */
+    std::vector<TilePair> pairs;
+
+    auto addPair = [&](const TileKey &keyA, const ofTexture &a, const TileKey &keyB, const ofTexture &b)
     {
-        // Draw poi
-        ofSetColor(255, 255, 0);
-        for (size_t i = 0; i < tileset->viewTargets.size(); i++)
+        ofVec2f position(keyA.x + tileset.offset.x, keyA.y + tileset.offset.y);
+        if (batched && tileBatch.supports(a, b))
+        {
+            if (tileBatch.add(keyA, a, keyB, b, position, tileset.blendAlpha))
+                return;
+
+            // The atlas is full
+            if (tileBatch.size() > 0)
+            {
+                tileBatch.flush(viewMatrix);
+                if (tileBatch.add(keyA, a, keyB, b, position, tileset.blendAlpha))
+                    return;
+            }
+        }
+
+        (batched ? tileFallbacks : pairs).push_back({position, &a, &b, tileset.blendAlpha});
+    };
+
+    bool twoLevels = tileset.t1 != tileset.t2;
+
+    // The pairs are drawn from their t1 tile
+    for (const TileKey &key : residentTiles.get(tileset.id, tileset.t1))
+    {
+        const ofTexture &tile = cacheMain.at(key);
+
+        TileKey other = key;
+        other.theta = static_cast<int16_t>(tileset.t2);
+        auto it = twoLevels ? cacheMain.find(other) : cacheMain.end();
+
+        if (it != cacheMain.end())
+            addPair(key, tile, other, it->second);
+        else
+            addPair(key, tile, key, tile);
+    }
+
+    // t2 tiles still waiting for their t1 partner
+    if (twoLevels)
+    {
+        for (const TileKey &key : residentTiles.get(tileset.id, tileset.t2))
+        {
+            TileKey other = key;
+            other.theta = static_cast<int16_t>(tileset.t1);
+            if (cacheMain.count(other))
+                continue;
+
+            const ofTexture &tile = cacheMain.at(key);
+            addPair(key, tile, key, tile);
+        }
+    }
+
+    drawTilePairs(pairs);
+}
+
+void ofApp::drawTilePairs(const std::vector<TilePair> &pairs)
+{
+    /*
+        Draws tile pairs one by one, b mixed over a by their alpha.
+        Compressed tiles are GL_TEXTURE_2D, which tile.frag cannot sample;
+        they are drawn after it with plain alpha blending instead.
+    */
+    if (pairs.empty())
+        return;
+
+    ofPushMatrix();
+    ofMultMatrix(viewMatrix);
+    ofSetColor(255);
+
+    tileShader.begin();
+    for (const TilePair &pair : pairs)
+    {
+        if (CompressedTile::isCompressed(*pair.a) || CompressedTile::isCompressed(*pair.b))
+            continue;
+
+        tileShader.setUniform1f("alpha", pair.alpha);
+        tileShader.setUniformTexture("texA", *pair.a, 1);
+        tileShader.setUniformTexture("texB", *pair.b, 2);
+        pair.a->draw(pair.position);
+    }
+    tileShader.end();
+
+    for (const TilePair &pair : pairs)
+    {
+        if (!CompressedTile::isCompressed(*pair.a) && !CompressedTile::isCompressed(*pair.b))
+            continue;
+
+        pair.a->draw(pair.position);
+        if (pair.b != pair.a)
         {
-            ofVec2f vt = tileset->viewTargets[i];
-            ofVec2f poi = worldToScreen(globalToWorld(vt, tileset));
-            ofDrawTriangle(poi, poi + ofVec2f(8, 10), poi + ofVec2f(-8, 10));
-            poi.x += 20 * sin(TWO_PI * i / tileset->viewTargets.size());
-            poi.y += 10 + 20 * cos(TWO_PI * i / tileset->viewTargets.size());
-            ofDrawBitmapString(ofToString(i), poi);
+            ofSetColor(255, 255.f * pair.alpha);
+            pair.b->draw(pair.position);
+            ofSetColor(255);
         }
     }
-    tileset->fboMain.end();
+    ofPopMatrix();
+}
+
+void ofApp::drawTileOutlines(const TileSet &tileset)
+{
+    ofPushMatrix();
+    ofMultMatrix(viewMatrix);
+    ofPushStyle();
+    ofNoFill();
+    ofSetColor(255, 0, 0);
+    ofSetLineWidth(3.f);
+    for (const TileKey &key : residentTiles.get(tileset.id, tileset.t1))
+        ofDrawRectangle(key.x + tileset.offset.x, key.y + tileset.offset.y, key.width, key.height);
+    ofPopStyle();
+    ofPopMatrix();
+}
+
+void ofApp::drawViewTargets(std::shared_ptr<TileSet> tileset)
+{
+    ofSetColor(255, 255, 0);
+    for (size_t i = 0; i < tileset->viewTargets.size(); i++)
+    {
+        ofVec2f vt = tileset->viewTargets[i];
+        ofVec2f poi = worldToScreen(globalToWorld(vt, tileset));
+        ofDrawTriangle(poi, poi + ofVec2f(8, 10), poi + ofVec2f(-8, 10));
+        poi.x += 20 * sin(TWO_PI * i / tileset->viewTargets.size());
+        poi.y += 10 + 20 * cos(TWO_PI * i / tileset->viewTargets.size());
+        ofDrawBitmapString(ofToString(i), poi);
+    }
 }
 
 void ofApp::calculateViewMatrix()
@@ -1169,7 +1562,7 @@ void ofApp::setViewTarget(ofVec2f worldCoords, float delayS)
 
     drillZoomAnim.pause();
     drill = false;
-    currentZoomSmooth.warmUp = 3.f;
+    currentZoomSmooth.warmUp = zoomWarmUp;
     currentZoomSmooth.speed = .2f;
     currentZoomSmooth.setTarget(flyHeight - zoomAdjust);
 
@@ -1184,19 +1577,62 @@ void ofApp::startRecording()
         return;
     }
 
+    recordingFileName = segmentName.empty() ? nextRecordingName() : segmentName;
+
+    fs::path videoPath{recordingDir};
+    videoPath /= (recordingFileName + ".mp4");
+
+    ofLog() << "Starting recording at " << videoPath;
+    ofLog() << "Resolution: " << ofGetWidth() << "x" << ofGetHeight();
+
+    ffmpegRecorder.setup(true, false, {ofGetWidth(), ofGetHeight()}, recordingFps, 24000);
+    ffmpegRecorder.setBackend(recorderBackend == "libav" ? ofxFFmpegRecorder::Backend::Libav : ofxFFmpegRecorder::Backend::Pipe);
+    ffmpegRecorder.setInputPixelFormat(OF_IMAGE_COLOR);
+    ffmpegRecorder.setOutputPath(videoPath);
+    ffmpegRecorder.setVideoCodec("libx264");
+    ffmpegRecorder.addAdditionalInputArgument("-hide_banner");
+    ffmpegRecorder.addAdditionalInputArgument("-loglevel error");
+    ffmpegRecorder.addAdditionalOutputArgument("-crf 16");
+    ffmpegRecorder.addAdditionalOutputArgument("-preset slow");
+    if (!ffmpegRecorder.startCustomRecord())
+    {
+        ofLogError() << "Could not start recording to " << videoPath;
+        if (offline)
+            ofExit(1);
+        return;
+    }
+
+    pathTrace.open(recordingDir, recordingFileName, tilesetManager.tilesetNames, pathTraceBinary);
+
+    time = 0.f;
+    recordStartTime = ofGetElapsedTimef();
+    frameCount = 0;
+    recording = true;
+
+    ofSetFrameRate(offline ? 0 : 120);
+
+    playSequence();
+
+    if (segmentFirstFrame > 0)
+        fastForward(segmentFirstFrame);
+}
+
+std::string ofApp::nextRecordingName()
+{
     size_t count = 0;
     ofDirectory recordings{recordingDir};
     recordings.listDir();
     auto recordingsList = recordings.getFiles();
 
+    std::string name;
     bool nameAvailable = false;
     while (!nameAvailable)
     {
-        recordingFileName = projectName + "_" + ofToString(count, 2, '0');
+        name = projectName + "_" + ofToString(count, 2, '0');
         nameAvailable = true;
         for (auto &file : recordingsList)
         {
-            if (file.getFileName() == recordingFileName + ".mp4")
+            if (file.getFileName() == name + ".mp4")
             {
                 count++;
                 nameAvailable = false;
@@ -1205,37 +1641,44 @@ void ofApp::startRecording()
         }
     }
 
-    fs::path videoPath{recordingDir};
-    videoPath /= (recordingFileName + ".mp4");
+    return name;
+}
 
-    ofLog() << "Starting recording at " << videoPath;
-    ofLog() << "Resolution: " << ofGetWidth() << "x" << ofGetHeight();
+void ofApp::fastForward(int frames)
+{
+    /*
+        Runs the fixed simulation steps of `frames` rendered frames without
+        drawing them or waiting for their tiles. The state afterwards is
+        the one frame `frames` of a full render is drawn in.
+    */
+    ofLogNotice() << "Fast forward to frame " << frames;
 
-    ffmpegRecorder.setup(true, false, {ofGetWidth(), ofGetHeight()}, recordingFps, 24000);
-    ffmpegRecorder.setInputPixelFormat(OF_IMAGE_COLOR);
-    ffmpegRecorder.setOutputPath(videoPath);
-    ffmpegRecorder.setVideoCodec("libx264");
-    ffmpegRecorder.addAdditionalInputArgument("-hide_banner");
-    ffmpegRecorder.addAdditionalInputArgument("-loglevel error");
-    ffmpegRecorder.addAdditionalOutputArgument("-crf 16");
-    ffmpegRecorder.addAdditionalOutputArgument("-preset slow");
-    ffmpegRecorder.startCustomRecord();
+    frameReady = true;
+    headless = true;
+    for (int i = 0; i < frames && sequencePlaying; i++)
+        stepSimulation(1.f / recordingFps);
+    headless = false;
+    frameReady = false;
 
-    // Prepare trace file
-    fs::path tracePath{recordingDir};
-    tracePath /= (recordingFileName + "_path.csv");
-    std::ofstream pathfile;
-    pathfile.open(tracePath);
-    pathfile << "t,frame,x,y,leftX,leftY,rightX,rightY,theta,zoomLevel,rotation,currentTileset,nextTileset,poi,distance" << std::endl;
+    frameCount = frames;
+}
 
-    time = 0.f;
-    recordStartTime = ofGetElapsedTimef();
-    frameCount = 0;
-    recording = true;
+void ofApp::renderSegments()
+{
+    int numFrames = static_cast<int>(compileTrack());
+    ofLogNotice() << "Rendering " << numFrames << " frames (" << formatTime(numFrames / recordingFps) << ") in " << segmentCount << " parts";
 
-    ofSetFrameRate(120);
+    std::string name = nextRecordingName();
+    SegmentedRender render(recordingDir, name, numFrames, segmentCount);
 
-    playSequence();
+    if (!render.render(ofFilePath::getCurrentExePath(), offlineProject))
+    {
+        ofLogError() << "Segmented render of " << name << " failed, the finished parts are kept";
+        return;
+    }
+
+    if (render.join(ffmpegRecorder.getFFmpegPath()))
+        ofLog() << "Render finished: " << recordingDir / (name + ".mp4");
 }
 
 void ofApp::stopRecording()
@@ -1246,13 +1689,13 @@ void ofApp::stopRecording()
         return;
     }
 
-    while (ffmpegRecorder.m_Frames.size())
-        ofSleepMillis(100);
+    frameReadback.flush([this](const ofPixels &pixels)
+                        { ffmpegRecorder.addSingleFrame(pixels); });
 
-    waitForFrames = false;
     time = 0.f;
     recordStartTime = ofGetElapsedTimef();
     ffmpegRecorder.stop();
+    pathTrace.close();
 
     fs::path statePath{recordingDir};
     statePath /= (recordingFileName + "_endstate.json");
@@ -1260,12 +1703,20 @@ void ofApp::stopRecording()
     dumpState(statePath);
 
     recording = false;
-    ofSetFrameRate(60);
     ofLog() << "Render finished";
+
+    if (offline)
+    {
+        ofExit();
+        return;
+    }
+
+    ofSetFrameRate(60);
 }
 
 void ofApp::playSequence(int step)
 {
+    trackPlaying = false;
     sequencePlaying = true;
     manualZooming = false;
     vel.set({0, 0});
@@ -1283,16 +1734,107 @@ void ofApp::nextStep()
     if (sequenceStep >= (int)sequence.size())
     {
         sequencePlaying = false;
-        // stop recording
+        if (recording)
+            stopRecording();
         return;
     }
 
     ofLog() << "Sequence step " + ofToString(sequenceStep);
+    stepStartTime = time;
     sequence[sequenceStep]->accept(*this);
 
     doneWaiting = false;
 }
 
+size_t ofApp::compileTrack()
+{
+    /*
+        Plays the sequence through at the recording frame rate without
+        drawing or loading tiles, storing the camera of every frame a
+        render would draw. Saved as the project's track.bin.
+    */
+    track.clear();
+    track.fps = recordingFps;
+
+    time = 0.f;
+    playSequence();
+
+    // Sequences that never end (e.g. waiting for a theta that is never
+    // reached) are cut at 24 hours
+    size_t maxFrames = static_cast<size_t>(24 * 3600 * recordingFps);
+
+    frameReady = true;
+    headless = true;
+    while (sequencePlaying && track.size() < maxFrames)
+    {
+        ofVec2f center = currentView.offsetWorld * currentZoom;
+        CameraTrack::Frame frame{center.x, center.y, currentZoomSmooth.getValue(), rotationAngle.getValue(), currentTheta.getValue(), 0,
+                                 static_cast<uint16_t>(std::max(sequenceStep, 0))};
+        track.add(frame, currentTileSet ? currentTileSet->name : "");
+
+        stepSimulation(1.f / recordingFps);
+    }
+    headless = false;
+    frameReady = false;
+    sequencePlaying = false;
+
+    fs::path trackPath{projectDir};
+    trackPath /= "track.bin";
+    if (!track.save(trackPath))
+        ofLogWarning() << "Could not save " << trackPath;
+
+    ofLogNotice() << "Compiled track: " << track.size() << " frames, " << formatTime(track.getDuration()) << " at " << track.fps << " fps";
+
+    seekTrack(0);
+
+    return track.size();
+}
+
+// Called when the sequence or layout is edited, which the compiled camera
+// no longer follows
+void ofApp::invalidateTrack()
+{
+    track.clear();
+    trackFrame = 0;
+    trackPlaying = false;
+}
+
+void ofApp::seekTrack(size_t frame)
+{
+    if (frame >= track.size())
+        return;
+
+    const CameraTrack::Frame &f = track[frame];
+    trackFrame = frame;
+
+    sequencePlaying = false;
+    drill = false;
+    viewTargetAnim.pause();
+    vel.set(0.f, 0.f);
+    offsetDelta.set(0.f, 0.f);
+
+    currentZoomSmooth.jumpTo(f.zoom);
+    currentZoomLevel = std::clamp(static_cast<int>(std::floor(f.zoom)), maxZoomLevel, minZoomLevel);
+    currentZoom = static_cast<int>(std::floor(std::powf(2, currentZoomLevel)));
+    if (currentZoomLevel != lastZoomLevel)
+        updateScale();
+    currentView.scale = std::powf(2.f, static_cast<float>(currentZoomLevel) - f.zoom);
+
+    rotationAngle.jumpTo(f.rotation);
+    currentTheta.jumpTo(f.theta);
+    currentView.theta = std::fmodf(f.theta + 180.f, 180.f);
+    tilesetManager.updateTheta(currentView.theta);
+
+    const std::string &tileset = track.tilesetName(f);
+    if (tilesetManager.contains(tileset))
+        currentTileSet = tilesetManager[tileset];
+
+    jumpTo(ofVec2f(f.x, f.y) / currentZoom);
+
+    sequenceStep = f.step;
+    time = frame / track.fps;
+}
+
 void ofApp::dumpState(const std::string &path)
 {
     ofLog() << "dumpState to " << path;
@@ -1673,6 +2215,8 @@ void ofApp::jumpToSequenceStep(size_t step, bool focusZoom)
 
 size_t ofApp::addSequenceEvent(std::shared_ptr<SequenceEvent> ev, int position)
 {
+    invalidateTrack();
+
     if (position >= (int)sequence.size())
     {
         sequence.emplace_back(std::move(ev));
@@ -1778,63 +2322,69 @@ bool ofApp::loadSequence(const std::string &name)
 
 void ofApp::renderScreenShot()
 {
-    // Only seems to work first time??
+    /*
+        Composes the whole layout at zoom level 5 and the current theta
+        from the tile files on a background thread, while the app keeps
+        running. Saved as overview.png in the projects folder.
+    */
+    if (stillExport.valid())
+    {
+        ofLogWarning() << "renderScreenShot called while an export is running";
+        return;
+    }
 
-    rendering = true;
-    rotationAngle.jumpTo(0);
-    currentTheta.jumpTo(0);
-    viewTargetAnim.pause();
-    spinSmooth.pause();
-    drillZoomAnim.pause();
+    // New, uncancelled exporters: a cancelExport() from here on holds even
+    // if it comes before the task has started
+    deepZoom.reset();
+    compositor = std::make_unique<TileCompositor>(tilesetManager, currentZoom);
 
-    jumpZoom(5.f);
-    calculateViewMatrix();
+    Zoom zoom = 32;
+    Theta theta = currentView.theta;
+    ofRectangle bounds = compositor->getLayoutBounds(zoom);
+    fs::path savePath{projectsDir};
+    savePath /= "overview.png";
 
-    layoutBounds = getLayoutBounds();
+    ofLog() << "Screenshot size: " << bounds.getWidth() << "x" << bounds.getHeight();
 
-    ofLog() << "Current zoom: " << currentZoom << ", currentZoomLevel " << currentZoomLevel << ", currentZoomSmooth " << currentZoomSmooth.getValue();
-    ofLog() << "Screenshot size: " << layoutBounds.getWidth() << "x" << layoutBounds.getHeight();
+    stillExport = std::async(std::launch::async, [this, bounds, zoom, theta, savePath]
+                             {
+        ofPixels pixels;
+        bool ok = compositor->compose(bounds, zoom, theta, pixels);
+        return ok && ofSaveImage(pixels, savePath); });
+}
 
-    screenshot.clear();
-    screenshot.allocate((int)layoutBounds.getWidth(), (int)layoutBounds.getHeight(), OF_PIXELS_BGRA);
-    screenshot.setColor(ofColor(0));
-    ofLog() << "Screenshot allocated: " << screenshot.getWidth() << "x" << screenshot.getHeight();
+void ofApp::exportDeepZoom(int zoomLevel)
+{
+    /*
+        Streams the whole layout at `zoomLevel` and the current theta into
+        a Deep Zoom pyramid in the Renders folder, on a background thread.
+        Unlike the overview it never holds the full image in memory, so it
+        works at any zoom level.
+    */
+    if (stillExport.valid())
+    {
+        ofLogWarning() << "exportDeepZoom called while an export is running";
+        return;
+    }
 
-    ofVec2f boundsOffsetWorld = screenToWorld(layoutBounds.getTopLeft());
-    ofVec2f screenCornerWorld = screenToWorld({0.f, 0.f});
-    ofVec2f screenCenterWorld = screenToWorld(screenCenter);
+    // New, uncancelled exporters, as in renderScreenShot()
+    deepZoom.reset();
+    compositor = std::make_unique<TileCompositor>(tilesetManager, currentZoom);
+    deepZoom = std::make_unique<DeepZoomExporter>(*compositor);
 
-    screenSizeWorld = (screenCenterWorld - screenCornerWorld) * 2.f;
-    topLayoutWorld = boundsOffsetWorld.y;
+    Zoom zoom = static_cast<int>(std::floor(std::powf(2, zoomLevel)));
+    Theta theta = currentView.theta;
+    fs::path savePath{recordingDir};
+    savePath /= std::format("{}_zoom{}.dzi", projectName, zoomLevel);
 
-    jumpTo(boundsOffsetWorld + screenCenterWorld - screenCornerWorld);
+    stillExport = std::async(std::launch::async, [this, zoom, theta, savePath]
+                             { return deepZoom->exportLayout(savePath, zoom, theta); });
 }
 
-void pasteInto(ofPixels &dstPixels, const ofPixels &src, int x, int y)
+void ofApp::cancelExport()
 {
-    int dstW = dstPixels.getWidth();
-    int dstH = dstPixels.getHeight();
-    int srcW = src.getWidth();
-    int srcH = src.getHeight();
-    int numChannels = src.getNumChannels();
-
-    for (int j = 0; j < srcH; j++)
-    {
-        int dstY = y + j;
-        if (dstY < 0 || dstY >= dstH)
-            continue; // clip outside
-
-        for (int i = 0; i < srcW; i++)
-        {
-            int dstX = x + i;
-            if (dstX < 0 || dstX >= dstW)
-                continue;
-
-            for (int c = 0; c < numChannels; c++)
-            {
-                dstPixels[(dstY * dstW + dstX) * numChannels + c] =
-                    src[(j * srcW + i) * numChannels + c];
-            }
-        }
-    }
-}
\ No newline at end of file
+    if (deepZoom)
+        deepZoom->cancel();
+    else if (compositor)
+        compositor->cancel();
+}
@@ -4,14 +4,25 @@
 #include <deque>
 #include <unordered_map>
 #include <format>
+#include <future>
 
 #include "ofMain.h"
 #include "SmoothValue.h"
 #include "TileCacheLRU.hpp"
 #include "AsyncTextureLoader.hpp"
+#include "FrameReadbackRing.hpp"
 #include "TilesetProperties.h"
 #include "TilesetManager.hpp"
 #include "Sequencer.hpp"
+#include "SequencePrefetcher.hpp"
+#include "SegmentedRender.hpp"
+#include "CameraTrack.hpp"
+#include "PathTraceWriter.hpp"
+#include "TileCompositor.hpp"
+#include "DeepZoomExporter.hpp"
+#include "TileBuckets.hpp"
+#include "TileBatch.hpp"
+#include "VirtualTexture.hpp"
 
 #include "ofxCsv.h"
 #include "ofxJSON.h"
@@ -47,6 +58,19 @@ public:
     void draw();
     void exit();
 
+    // Set before setup() to render `offlineProject` without a visible
+    // window or GUI and exit when done
+    bool offline = false;
+    std::string offlineProject;
+
+    // Offline only: split the render into `segmentCount` processes, or,
+    // in one of those, record frames [segmentFirstFrame, segmentEndFrame)
+    // as `segmentName`
+    int segmentCount = 1;
+    int segmentFirstFrame = 0;
+    int segmentEndFrame = 0;
+    std::string segmentName;
+
     void keyPressed(ofKeyEventArgs &key);
     void mouseMoved(int x, int y);
     void mouseDragged(int x, int y, int button);
@@ -64,6 +88,21 @@ public:
 
     ofFbo fboFinal;
     ofShader blendShader;
+    ofShader tileShader;
+    TileBatch tileBatch;
+
+    // Tile drawn with b mixed over a by alpha, outside of tileBatch
+    struct TilePair
+    {
+        ofVec2f position;
+        const ofTexture *a;
+        const ofTexture *b;
+        float alpha;
+    };
+    std::vector<TilePair> tileFallbacks; // batched tiles the atlas had no room for
+    VirtualTexture virtualTexture;
+    int tileAtlasMB = 512;
+    FboPool fboPool;
     ofPlanePrimitive plane;
 
     ofxFFmpegRecorder ffmpegRecorder;
@@ -73,13 +112,18 @@ public:
     fs::path recordingDir;
 
     bool frameReady = false;
+    // Set while fastForward() and compileTrack() step the simulation
+    // without drawing, so no tiles are preloaded or prefetched
+    bool headless = false;
     bool recording = false;
-    bool waitForFrames = false;
-    int numFramesQueued;
     int frameCount = 0;
-    ofPixels framePixels;
+    FrameReadbackRing frameReadback;
     ofImage frame;
     float recordingFps = 30.f;
+    std::string recorderBackend = "pipe";
+    std::string renderPath = "batched";
+    PathTraceWriter pathTrace;
+    bool pathTraceBinary = false;
 
     bool recordPath = false;
     float recordPathDt = 0.1;
@@ -90,6 +134,7 @@ public:
     float lastFrameTime;
 
     AsyncTextureLoader loader;
+    float uploadBudgetMs = 4.f;
     View currentView;
 
     ofMatrix4x4 viewMatrix;
@@ -102,6 +147,7 @@ public:
 
     float zoomAdjust = 0.f;
     float zoomSpeed = 4.f;
+    float zoomWarmUp = 3.f; // of currentZoomSmooth during flights
     const float maxZoom = 1.f;
     const float minZoom = 8.f;
     const int maxZoomLevel = 1;
@@ -151,9 +197,14 @@ public:
     SmoothValueLinear rotationAngle = {2.f, 0.f, -360.f, 720.f};
 
     TilesetManager tilesetManager;
+    SequencePrefetcher prefetcher{tilesetManager};
+    float prefetchSeconds = 8.f;
+    size_t prefetchRequests = 0;
 
     std::unordered_map<TileKey, ofTexture> cacheMain;
-    TileCacheLRU cacheSecondary{600};
+    size_t cacheMainBytes = 0;
+    TileBuckets residentTiles;
+    TileCacheLRU cacheSecondary{size_t(1024) << 20};
     int cacheMisses = 0;
 
     int numberVisibleTiles = 0;
@@ -161,19 +212,39 @@ public:
     std::vector<shared_ptr<SequenceEvent>> sequence;
     std::vector<shared_ptr<POI>> sequencePoi;
     int sequenceStep;
+    float stepStartTime = 0.f;
     bool sequencePlaying = false;
 
+    CameraTrack track;
+    size_t trackFrame = 0;
+    bool trackPlaying = false;
+    size_t compileTrack();
+    void seekTrack(size_t frame);
+    void invalidateTrack();
+
     void createProject(const std::string &name);
     void loadProject(const std::string &name);
     bool isVisible(const ofRectangle &rect, ofVec2f offset = {0.f, 0.f});
     bool isVisible(const TileKey &key, ofVec2f offset = {0.f, 0.f});
+    ofRectangle getViewBoundsWorld();
     ofRectangle getLayoutBounds();
     bool updateCaches();
+    void putMain(const TileKey &key, const ofTexture &tile);
+    void stepSimulation(float dt);
     void preloadZoom(int level);
+    void prefetchSequence();
+    float tilePriority(const TileKey &key, const TileSet &tileset, bool visible, float centerDistance) const;
     void drawTiles(std::shared_ptr<TileSet> tileset);
+    void drawTilesSinglePass(const TileSet &tileset, bool batched);
+    void drawTilePairs(const std::vector<TilePair> &pairs);
+    void drawTileOutlines(const TileSet &tileset);
+    void drawViewTargets(std::shared_ptr<TileSet> tileset);
     void setViewTarget(ofVec2f worldCoords, float delayS = 0.f);
     void startRecording();
     void stopRecording();
+    std::string nextRecordingName();
+    void fastForward(int frames);
+    void renderSegments();
     void playSequence(int step = 0);
     void nextStep();
     void animationFinished(ofxAnimatableFloat::AnimationEvent &ev);
@@ -206,11 +277,11 @@ public:
     bool loadSequence(const std::string &name);
 
     void renderScreenShot();
-    bool rendering = false;
-    ofVec2f screenSizeWorld;
-    ofRectangle layoutBounds;
-    float topLayoutWorld;
-    ofPixels screenshot;
+    void exportDeepZoom(int zoomLevel);
+    void cancelExport();
+    std::unique_ptr<TileCompositor> compositor;
+    std::unique_ptr<DeepZoomExporter> deepZoom;
+    std::future<bool> stillExport;
 
     void calculateViewMatrix();
     float updateScale();
@@ -228,6 +299,4 @@ public:
     std::unordered_map<std::string, float *> parameters;
 };
 
-void pasteInto(ofPixels &dstPixels, const ofPixels &src, int x, int y);
-
 std::string formatTime(float timeSeconds);
\ No newline at end of file
@@ -89,6 +89,7 @@ void ofApp::drawGUI()
             ofLog() << "Adding scan " << tilesetManager.scanListOptions[scan_selected_idx];
             tilesetManager.addTileSet(tilesetManager.scanListOptions[scan_selected_idx], "", "", "");
             tilesetManager.computeLayout(currentZoom);
+            invalidateTrack();
         }
 
         if (cannot_add)
@@ -161,6 +162,7 @@ void ofApp::drawGUI()
                         tilesetManager.layout[i] = tilesetManager.layout[n_next];
                         tilesetManager.layout[n_next] = layoutPos;
                         tilesetManager.computeLayout(currentZoom);
+                        invalidateTrack();
                         ImGui::ResetMouseDragDelta();
                     }
                 }
@@ -184,6 +186,7 @@ void ofApp::drawGUI()
                     tilesetManager.layout[selected_layout].position = Position::BELOW;
 
                 tilesetManager.computeLayout(currentZoom);
+                invalidateTrack();
             }
 
             std::string relative_to_preview = "<previous>";
@@ -211,6 +214,7 @@ void ofApp::drawGUI()
                             relative_idx = 0;
                             tilesetManager.layout[selected_layout].relativeTo = "";
                             tilesetManager.computeLayout(currentZoom);
+                            invalidateTrack();
                         }
                     }
                     else
@@ -222,6 +226,7 @@ void ofApp::drawGUI()
                                 relative_idx = n;
                                 tilesetManager.layout[selected_layout].relativeTo = relative_name;
                                 tilesetManager.computeLayout(currentZoom);
+                                invalidateTrack();
                             }
                     }
                 }
@@ -239,9 +244,33 @@ void ofApp::drawGUI()
                     tilesetManager.layout[selected_layout].alignment = Alignment::END;
 
                 tilesetManager.computeLayout(currentZoom);
+                invalidateTrack();
             }
         }
 
+        ImGui::SeparatorText("Export");
+        static int deepZoomLevel = 1;
+        if (stillExport.valid())
+        {
+            if (deepZoom)
+                ImGui::Text("Deep zoom: %zu / %zu rows", deepZoom->getRowsDone(), deepZoom->getRowsTotal());
+            else
+                ImGui::Text("Composing overview: %zu / %zu tiles", compositor->getTilesDone(), compositor->getTilesTotal());
+            ImGui::SameLine();
+            if (ImGui::Button("Cancel"))
+                cancelExport();
+        }
+        else
+        {
+            if (ImGui::Button("Export overview"))
+                renderScreenShot();
+
+            ImGui::SliderInt("Zoom level", &deepZoomLevel, maxZoomLevel, minZoomLevel);
+            ImGui::SameLine();
+            if (ImGui::Button("Export deep zoom"))
+                exportDeepZoom(deepZoomLevel);
+        }
+
         ImGui::Dummy({10, 10});
         ImGui::TreePop();
     }
@@ -547,6 +576,7 @@ void ofApp::drawGUI()
                                     auto *loadEv = dynamic_cast<Load *>(ev.get());
                                     if (loadEv)
                                         loadEv->statePath = result.getPath();
+                                    invalidateTrack();
 
                                     ImGui::CloseCurrentPopup();
                                 }
@@ -559,12 +589,16 @@ void ofApp::drawGUI()
                             {
                                 ofLog() << "Update to " << newValue;
                                 ev->value = newValue;
+                                invalidateTrack();
                                 ImGui::CloseCurrentPopup();
                             }
                         }
 
                         if (ImGui::Button("Delete"))
+                        {
                             sequence.erase(sequence.begin() + selected_event);
+                            invalidateTrack();
+                        }
 
                         if (ImGui::BeginMenu("Add"))
                         {
@@ -589,6 +623,7 @@ void ofApp::drawGUI()
                         if (n_next >= 0 && n_next < (int)sequence.size())
                         {
                             std::swap(sequence[i], sequence[n_next]);
+                            invalidateTrack();
                             ImGui::ResetMouseDragDelta();
                         }
                     }
@@ -626,6 +661,24 @@ void ofApp::drawGUI()
         if (ImGui::Button("Play from selection"))
             playSequence(selected_event);
 
+        ImGui::SeparatorText("Track");
+        if (ImGui::Button("Compile track"))
+            compileTrack();
+
+        if (!track.empty())
+        {
+            ImGui::SameLine();
+            ImGui::Text("%zu frames, %s", track.size(), formatTime(track.getDuration()).c_str());
+
+            int frame = static_cast<int>(trackFrame);
+            if (ImGui::SliderInt("Frame", &frame, 0, static_cast<int>(track.size()) - 1))
+            {
+                trackPlaying = false;
+                seekTrack(frame);
+            }
+            ImGui::Checkbox("Play track", &trackPlaying);
+        }
+
         ImGui::Dummy({10, 10});
         ImGui::TreePop();
     }
@@ -708,6 +761,65 @@ void ofApp::drawGUI()
 
             ImGui::EndTable();
         }
+        ImGui::SeparatorText("Tile uploads");
+        ImGui::SliderFloat("budget (ms)", &uploadBudgetMs, 0.5f, 16.f);
+        ImGui::SliderFloat("prefetch (s)", &prefetchSeconds, 0.f, 30.f);
+
+        const AsyncTextureLoader::UploadStats &uploadStats = loader.getUploadStats();
+        if (ImGui::BeginTable("uploadStats", 2))
+        {
+            ImGui::TableNextColumn();
+            ImGui::Text("backlog");
+            ImGui::TableNextColumn();
+            ImGui::Text("%zu", uploadStats.backlog);
+
+            ImGui::TableNextColumn();
+            ImGui::Text("uploaded");
+            ImGui::TableNextColumn();
+            ImGui::Text("%zu (%.2f ms)", uploadStats.uploadedLastFrame, uploadStats.uploadTimeMs);
+
+            ImGui::TableNextColumn();
+            ImGui::Text("upload latency");
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f ms", uploadStats.uploadLatencyMs);
+
+            ImGui::TableNextColumn();
+            ImGui::Text("request latency");
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f ms", uploadStats.requestLatencyMs);
+
+            ImGui::TableNextColumn();
+            ImGui::Text("decode allocations");
+            ImGui::TableNextColumn();
+            ImGui::Text("%zu / %zu decoded", loader.numDecodeAllocations(), loader.numDecoded());
+
+            ImGui::TableNextColumn();
+            ImGui::Text("compressed");
+            ImGui::TableNextColumn();
+            ImGui::Text("%zu tiles", loader.numCompressed());
+
+            ImGui::TableNextColumn();
+            ImGui::Text("prefetch");
+            ImGui::TableNextColumn();
+            ImGui::Text("%zu tiles", prefetchRequests);
+
+            ImGui::EndTable();
+        }
+
+        ImGui::SeparatorText("Render targets");
+        ImGui::Text("Tileset framebuffers: %zu (%zu free)", fboPool.size(), fboPool.numFree());
+        if (renderPath == "virtual")
+            ImGui::Text("Virtual texture: %zu / %d pages, %zu on screen, %zu missing, %zu sampled", virtualTexture.atlas.size(), virtualTexture.atlas.getNumSlots(),
+                        virtualTexture.numNeeded(), virtualTexture.numMissing(), virtualTexture.numSampled());
+        else
+            ImGui::Text("Tile atlas: %zu / %d slots, %zu copied, %zu batched", tileBatch.atlas.size(), tileBatch.atlas.getNumSlots(),
+                        tileBatch.atlas.getNumCopies(), tileBatch.size());
+
+        ImGui::SeparatorText("Frame readback");
+        ImGui::Text("%zu pending, latency %.1f ms", frameReadback.numPending(), frameReadback.getLatencyMs());
+        ImGui::Text("Encoder queue %zu / %zu, %.1f fps (%s)", ffmpegRecorder.getNumQueuedFrames(), ffmpegRecorder.getFrameQueueSize(),
+                    ffmpegRecorder.getEncodeFps(), recorderBackend.c_str());
+
         // ofRectangle bounds = getLayoutBounds();
         // ImGui::Text("Layout bounds: %.2f, %.2f, %.2f, %.2f", bounds.getX(), bounds.getY(), bounds.getWidth(), bounds.getHeight());
 
@@ -0,0 +1,278 @@
+#include "ofxFFmpegLibavEncoder.h"
+
+#ifdef OFX_FFMPEG_RECORDER_LIBAV
+
+// openFrameworks
+#include "ofLog.h"
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+// Logging macros
+#define LOG_ERROR(message) ofLogError("") << __FUNCTION__ << ":" << __LINE__ << ": " << message
+#define LOG_WARNING(message) ofLogWarning("") << __FUNCTION__ << ":" << __LINE__ << ": " << message
+#define LOG_NOTICE(message) ofLogNotice("") << __FUNCTION__ << ":" << __LINE__ << ": " << message
+
+namespace
+{
+    std::string errorString(int error)
+    {
+        char buffer[AV_ERROR_MAX_STRING_SIZE] = {0};
+        av_strerror(error, buffer, sizeof(buffer));
+        return buffer;
+    }
+}
+
+ofxFFmpegLibavEncoder::~ofxFFmpegLibavEncoder()
+{
+    close();
+}
+
+bool ofxFFmpegLibavEncoder::open(const std::string &path, int width, int height, float fps, const std::string &codec,
+                                 const std::string &inputPixFmt, const std::string &outputPixFmt, const Options &options)
+{
+    close();
+
+    const AVCodec *encoder = avcodec_find_encoder_by_name(codec.c_str());
+    if (encoder == nullptr)
+    {
+        LOG_ERROR("Encoder " + codec + " is not available in this libavcodec.");
+        return false;
+    }
+
+    m_InputPixFmt = av_get_pix_fmt(inputPixFmt.c_str());
+    AVPixelFormat outputFormat = av_get_pix_fmt(outputPixFmt.c_str());
+    if (m_InputPixFmt == AV_PIX_FMT_NONE || outputFormat == AV_PIX_FMT_NONE)
+    {
+        LOG_ERROR("Unknown pixel format " + inputPixFmt + " or " + outputPixFmt);
+        return false;
+    }
+
+    int error = avformat_alloc_output_context2(&m_Format, nullptr, nullptr, path.c_str());
+    if (error < 0)
+    {
+        LOG_ERROR("Cannot create a container for " + path + ": " + errorString(error));
+        release();
+        return false;
+    }
+
+    m_Stream = avformat_new_stream(m_Format, nullptr);
+    m_Codec = avcodec_alloc_context3(encoder);
+    if (m_Stream == nullptr || m_Codec == nullptr)
+    {
+        LOG_ERROR("Cannot allocate the encoder.");
+        release();
+        return false;
+    }
+
+    m_Codec->width = width;
+    m_Codec->height = height;
+    m_Codec->pix_fmt = outputFormat;
+    m_Codec->framerate = av_d2q(fps, 100000);
+    m_Codec->time_base = av_inv_q(m_Codec->framerate);
+    m_Codec->color_range = AVCOL_RANGE_MPEG;
+    m_Codec->colorspace = AVCOL_SPC_BT709;
+    m_Codec->color_primaries = AVCOL_PRI_BT709;
+    m_Codec->color_trc = AVCOL_TRC_BT709;
+    if (m_Format->oformat->flags & AVFMT_GLOBALHEADER)
+    {
+        m_Codec->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    AVDictionary *dict = nullptr;
+    for (const auto &[key, value] : options)
+    {
+        av_dict_set(&dict, key.c_str(), value.c_str(), 0);
+    }
+
+    error = avcodec_open2(m_Codec, encoder, &dict);
+
+    const AVDictionaryEntry *unused = nullptr;
+    while ((unused = av_dict_get(dict, "", unused, AV_DICT_IGNORE_SUFFIX)) != nullptr)
+    {
+        LOG_WARNING(std::string("Encoder option ") + unused->key + " was not used.");
+    }
+    av_dict_free(&dict);
+
+    if (error < 0)
+    {
+        LOG_ERROR("Cannot open encoder " + codec + ": " + errorString(error));
+        release();
+        return false;
+    }
+
+    avcodec_parameters_from_context(m_Stream->codecpar, m_Codec);
+    m_Stream->time_base = m_Codec->time_base;
+    m_Stream->avg_frame_rate = m_Codec->framerate;
+
+    if (!(m_Format->oformat->flags & AVFMT_NOFILE))
+    {
+        error = avio_open(&m_Format->pb, path.c_str(), AVIO_FLAG_WRITE);
+        if (error < 0)
+        {
+            LOG_ERROR("Cannot open " + path + ": " + errorString(error));
+            release();
+            return false;
+        }
+    }
+
+    error = avformat_write_header(m_Format, nullptr);
+    if (error < 0)
+    {
+        LOG_ERROR("Cannot write the header of " + path + ": " + errorString(error));
+        release();
+        return false;
+    }
+
+    m_Frame = av_frame_alloc();
+    m_Packet = av_packet_alloc();
+    m_Frame->format = outputFormat;
+    m_Frame->width = width;
+    m_Frame->height = height;
+    if (av_frame_get_buffer(m_Frame, 0) < 0)
+    {
+        LOG_ERROR("Cannot allocate the frame buffer.");
+        release();
+        return false;
+    }
+
+    m_Pts = 0;
+
+    LOG_NOTICE("Encoding " + path + " with " + codec + " in-process");
+    return true;
+}
+
+bool ofxFFmpegLibavEncoder::encode(const ofPixels &pixels)
+{
+    if (!isOpen())
+    {
+        return false;
+    }
+
+    // Recreated only if the size of the incoming frames changes
+    SwsContext *sws = sws_getCachedContext(m_Sws, pixels.getWidth(), pixels.getHeight(), static_cast<AVPixelFormat>(m_InputPixFmt),
+                                           m_Codec->width, m_Codec->height, m_Codec->pix_fmt, SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if (sws == nullptr)
+    {
+        LOG_ERROR("Cannot convert the frame to the encoder's pixel format.");
+        return false;
+    }
+    if (sws != m_Sws)
+    {
+        // Matches the BT.709 limited range the stream is tagged with
+        const int *coefficients = sws_getCoefficients(SWS_CS_ITU709);
+        sws_setColorspaceDetails(sws, coefficients, 1, coefficients, 0, 0, 1 << 16, 1 << 16);
+        m_Sws = sws;
+    }
+
+    if (av_frame_make_writable(m_Frame) < 0)
+    {
+        return false;
+    }
+
+    const uint8_t *src[1] = {pixels.getData()};
+    const int srcStride[1] = {static_cast<int>(pixels.getWidth() * pixels.getNumChannels())};
+    sws_scale(m_Sws, src, srcStride, 0, pixels.getHeight(), m_Frame->data, m_Frame->linesize);
+
+    m_Frame->pts = m_Pts++;
+    return send(m_Frame);
+}
+
+bool ofxFFmpegLibavEncoder::beginFrame(uint8_t *planes[3], int strides[3])
+{
+    if (!isOpen() || av_frame_make_writable(m_Frame) < 0)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        planes[i] = m_Frame->data[i];
+        strides[i] = m_Frame->linesize[i];
+    }
+    return true;
+}
+
+bool ofxFFmpegLibavEncoder::endFrame()
+{
+    m_Frame->pts = m_Pts++;
+    return send(m_Frame);
+}
+
+bool ofxFFmpegLibavEncoder::close()
+{
+    if (!isOpen())
+    {
+        return false;
+    }
+
+    // A null frame drains the frames the encoder still looks ahead on
+    bool ok = send(nullptr);
+
+    int error = av_write_trailer(m_Format);
+    if (error < 0)
+    {
+        LOG_ERROR("Cannot finish the file: " + errorString(error));
+        ok = false;
+    }
+
+    release();
+    return ok;
+}
+
+bool ofxFFmpegLibavEncoder::isOpen() const
+{
+    return m_Frame != nullptr && m_Packet != nullptr;
+}
+
+bool ofxFFmpegLibavEncoder::send(AVFrame *frame)
+{
+    int error = avcodec_send_frame(m_Codec, frame);
+    if (error < 0)
+    {
+        LOG_WARNING("Cannot encode the frame: " + errorString(error));
+        return false;
+    }
+
+    while ((error = avcodec_receive_packet(m_Codec, m_Packet)) >= 0)
+    {
+        av_packet_rescale_ts(m_Packet, m_Codec->time_base, m_Stream->time_base);
+        m_Packet->stream_index = m_Stream->index;
+
+        // Takes over the packet's data and unreferences it
+        error = av_interleaved_write_frame(m_Format, m_Packet);
+        if (error < 0)
+        {
+            LOG_WARNING("Cannot write the packet: " + errorString(error));
+            return false;
+        }
+    }
+
+    return error == AVERROR(EAGAIN) || error == AVERROR_EOF;
+}
+
+void ofxFFmpegLibavEncoder::release()
+{
+    if (m_Format != nullptr && m_Format->pb != nullptr && !(m_Format->oformat->flags & AVFMT_NOFILE))
+    {
+        avio_closep(&m_Format->pb);
+    }
+
+    sws_freeContext(m_Sws);
+    av_packet_free(&m_Packet);
+    av_frame_free(&m_Frame);
+    avcodec_free_context(&m_Codec);
+    avformat_free_context(m_Format);
+
+    m_Sws = nullptr;
+    m_Format = nullptr;
+    m_Stream = nullptr;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+// openFrameworks
+#include "ofPixels.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef OFX_FFMPEG_RECORDER_LIBAV
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVStream;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+
+/**
+ * @brief Encodes frames in-process with libavcodec and muxes them with libavformat, as an alternative to piping raw
+ * frames into an ffmpeg process. Only built when OFX_FFMPEG_RECORDER_LIBAV is defined and the libav libraries are linked.
+ */
+class ofxFFmpegLibavEncoder
+{
+public:
+    using Options = std::vector<std::pair<std::string, std::string>>;
+
+    ofxFFmpegLibavEncoder() = default;
+    ofxFFmpegLibavEncoder(const ofxFFmpegLibavEncoder &) = delete;
+    ofxFFmpegLibavEncoder &operator=(const ofxFFmpegLibavEncoder &) = delete;
+    ~ofxFFmpegLibavEncoder();
+
+    /**
+     * @brief Opens `path` for writing. The container follows from the file extension.
+     * @param inputPixFmt libav name of the pixel format frames are passed in, e.g. "rgb24"
+     * @param outputPixFmt libav name of the pixel format that is encoded, e.g. "yuv420p"
+     * @param options Encoder options, e.g. {"crf", "16"} and {"preset", "slow"} for libx264
+     */
+    bool open(const std::string &path, int width, int height, float fps, const std::string &codec,
+              const std::string &inputPixFmt, const std::string &outputPixFmt, const Options &options);
+
+    /**
+     * @brief Converts and encodes one frame. Encoded packets are written as soon as the encoder hands them out.
+     */
+    bool encode(const ofPixels &pixels);
+
+    /**
+     * @brief Returns the planes of the next frame, for callers that write it in the output pixel format themselves.
+     * The frame is encoded by @ref endFrame().
+     */
+    bool beginFrame(uint8_t *planes[3], int strides[3]);
+    bool endFrame();
+
+    /**
+     * @brief Flushes the frames still held by the encoder and finishes the file.
+     */
+    bool close();
+
+    bool isOpen() const;
+
+private:
+    bool send(AVFrame *frame);
+    void release();
+
+    AVFormatContext *m_Format = nullptr;
+    AVCodecContext *m_Codec = nullptr;
+    AVStream *m_Stream = nullptr;
+    AVFrame *m_Frame = nullptr;
+    AVPacket *m_Packet = nullptr;
+    SwsContext *m_Sws = nullptr;
+    int m_InputPixFmt = -1;
+    int64_t m_Pts = 0;
+};
+
+#endif
@@ -4,6 +4,9 @@
 #include "ofVideoGrabber.h"
 #include "ofSoundStream.h"
 
+// Tags for frames converted by YuvConverter, so ffmpeg neither converts them again nor guesses their colour space
+static const std::string bt709Arguments = "-color_range tv -colorspace bt709 -color_primaries bt709 -color_trc bt709";
+
 // Logging macros
 #define LOG_ERROR(message) ofLogError("") << __FUNCTION__ << ":" << __LINE__ << ": " << message
 #define LOG_WARNING(message) ofLogWarning("") << __FUNCTION__ << ":" << __LINE__ << ": " << message
@@ -288,6 +291,26 @@ void ofxFFmpegRecorder::setOutputPixelFormat(ofImageType aType)
     }
 }
 
+//-------------------------------------------
+void ofxFFmpegRecorder::setBackend(Backend backend)
+{
+    m_Backend = backend;
+}
+
+ofxFFmpegRecorder::Backend ofxFFmpegRecorder::getBackend() const
+{
+    return m_Backend;
+}
+
+bool ofxFFmpegRecorder::isLibavAvailable()
+{
+#ifdef OFX_FFMPEG_RECORDER_LIBAV
+    return true;
+#else
+    return false;
+#endif
+}
+
 //-------------------------------------------
 float ofxFFmpegRecorder::getRecordedDuration() const
 {
@@ -372,6 +395,12 @@ bool ofxFFmpegRecorder::record(float duration)
     m_DefaultRecordingFile = popen(cmd.c_str(), "w");
 #endif
 
+    if (m_DefaultRecordingFile == nullptr)
+    {
+        LOG_ERROR("Could not start ffmpeg: " + m_FFmpegPath);
+        return false;
+    }
+
     return true;
 }
 
@@ -397,6 +426,39 @@ bool ofxFFmpegRecorder::startCustomRecord()
     }
 
     m_AddedVideoFrames = 0;
+    mBStopRequested = false;
+
+    size_t channels = 3;
+    if (mInputPixFmt == "gray")
+    {
+        channels = 1;
+    }
+    else if (mInputPixFmt == "rgba")
+    {
+        channels = 4;
+    }
+    m_Frames.reset(m_FrameQueueSize, m_VideoSize.x, m_VideoSize.y, channels);
+    m_EncodeFps = 0.f;
+
+    // Colour frames are converted to yuv420p on the writer thread, ffmpeg then only encodes
+    m_IsConvertingYuv = m_ConvertYuv && channels >= 3;
+    if (m_IsConvertingYuv)
+    {
+        if (m_YuvConverter == nullptr)
+        {
+            m_YuvConverter = std::make_unique<YuvConverter>();
+        }
+        m_YuvFrame.resize(YuvConverter::frameBytes(m_VideoSize.x, m_VideoSize.y));
+    }
+
+    if (m_Backend == Backend::Libav)
+    {
+        if (isLibavAvailable())
+        {
+            return startLibavRecord();
+        }
+        LOG_WARNING("Built without OFX_FFMPEG_RECORDER_LIBAV, recording through the ffmpeg pipe instead.");
+    }
 
     std::vector<std::string> args;
     std::copy(m_AdditionalInputArguments.begin(), m_AdditionalInputArguments.end(), std::back_inserter(args));
@@ -409,7 +471,15 @@ bool ofxFFmpegRecorder::startCustomRecord()
     args.push_back("-s " + std::to_string(static_cast<unsigned int>(m_VideoSize.x)) + "x" + std::to_string(static_cast<unsigned int>(m_VideoSize.y)));
     args.push_back("-f rawvideo");
     // args.push_back("-pix_fmt rgb24");
-    args.push_back("-pix_fmt " + mInputPixFmt);
+    if (m_IsConvertingYuv)
+    {
+        args.push_back("-pix_fmt yuv420p");
+        args.push_back(bt709Arguments);
+    }
+    else
+    {
+        args.push_back("-pix_fmt " + mInputPixFmt);
+    }
     args.push_back("-vcodec rawvideo");
     args.push_back("-i -");
 
@@ -420,6 +490,10 @@ bool ofxFFmpegRecorder::startCustomRecord()
     //    args.push_back("-pix_fmt " + mOutputPixFmt );
     // args.push_back("-pix_fmt " + mOutputPixFmt);
     args.push_back("-pix_fmt yuv420p");
+    if (m_IsConvertingYuv)
+    {
+        args.push_back(bt709Arguments);
+    }
     std::copy(m_AdditionalOutputArguments.begin(), m_AdditionalOutputArguments.end(), std::back_inserter(args));
 
     args.push_back(ofToDataPath(m_OutputPath, true));
@@ -440,6 +514,12 @@ bool ofxFFmpegRecorder::startCustomRecord()
     m_CustomRecordingFile = popen(cmd.c_str(), "w");
 #endif // _WIN32
 
+    if (m_CustomRecordingFile == nullptr)
+    {
+        LOG_ERROR("Could not start ffmpeg: " + m_FFmpegPath);
+        return false;
+    }
+
     return true;
 }
 
@@ -452,7 +532,7 @@ size_t ofxFFmpegRecorder::addFrame(const ofPixels &pixels)
         return 0;
     }
 
-    if (m_CustomRecordingFile == nullptr)
+    if (!isRecordingCustom())
     {
         LOG_ERROR("Custom recording is not in proggress. Cannot add the frame.");
         return 0;
@@ -480,7 +560,7 @@ size_t ofxFFmpegRecorder::addFrame(const ofPixels &pixels)
     while (m_AddedVideoFrames == 0 || delta >= framerate)
     {
         delta -= framerate;
-        m_Frames.produce(new ofPixels(pixels));
+        pushFrame(pixels);
         m_AddedVideoFrames++;
         written++;
     }
@@ -497,7 +577,7 @@ size_t ofxFFmpegRecorder::addSingleFrame(const ofPixels &pixels)
         return 0;
     }
 
-    if (m_CustomRecordingFile == nullptr)
+    if (!isRecordingCustom())
     {
         LOG_ERROR("Custom recording is not in proggress. Cannot add the frame.");
         return 0;
@@ -515,19 +595,67 @@ size_t ofxFFmpegRecorder::addSingleFrame(const ofPixels &pixels)
         m_RecordStartTime = std::chrono::high_resolution_clock::now();
     }
 
-    m_Frames.produce(new ofPixels(pixels));
+    pushFrame(pixels);
     m_AddedVideoFrames++;
 
     return 1;
 }
 
+//-------------------------------------------
+void ofxFFmpegRecorder::setFrameQueueSize(size_t frames)
+{
+    m_FrameQueueSize = std::max<size_t>(frames, 1);
+}
+
+size_t ofxFFmpegRecorder::getFrameQueueSize() const
+{
+    return m_FrameQueueSize;
+}
+
+size_t ofxFFmpegRecorder::getNumQueuedFrames() const
+{
+    return m_Frames.size();
+}
+
+float ofxFFmpegRecorder::getEncodeFps() const
+{
+    return m_EncodeFps;
+}
+
+void ofxFFmpegRecorder::setConvertToYuv(bool convert)
+{
+    m_ConvertYuv = convert;
+}
+
+bool ofxFFmpegRecorder::isConvertToYuv() const
+{
+    return m_ConvertYuv;
+}
+
 //-------------------------------------------
 void ofxFFmpegRecorder::stop()
 {
-    mBStopRequested = false;
-    if (m_CustomRecordingFile)
+    if (m_IsRecordingLibav)
     {
-        mBStopRequested = true;
+        m_Frames.close();
+        if (m_Thread.joinable())
+        {
+            joinThread();
+        }
+#ifdef OFX_FFMPEG_RECORDER_LIBAV
+        m_Encoder.close();
+#endif
+        m_IsRecordingLibav = false;
+        m_AddedVideoFrames = 0;
+    }
+    else if (m_CustomRecordingFile)
+    {
+        // The writer thread finishes the queued frames before ffmpeg's input is closed
+        m_Frames.close();
+        if (m_Thread.joinable())
+        {
+            joinThread();
+        }
 #if defined(_WIN32)
         _pclose(m_CustomRecordingFile);
 #else
@@ -535,9 +663,6 @@ void ofxFFmpegRecorder::stop()
 #endif
         m_CustomRecordingFile = nullptr;
         m_AddedVideoFrames = 0;
-        ofLogNotice("ofxFFmpegRecorder::stop : trying to join thread joinable: ") << m_Thread.joinable();
-        joinThread();
-        mBStopRequested = false;
     }
     else if (m_DefaultRecordingFile)
     {
@@ -553,8 +678,28 @@ void ofxFFmpegRecorder::stop()
 
 void ofxFFmpegRecorder::cancel()
 {
-    if (m_CustomRecordingFile)
+    if (m_IsRecordingLibav)
+    {
+        mBStopRequested = true;
+        m_Frames.close();
+        if (m_Thread.joinable())
+        {
+            joinThread();
+        }
+#ifdef OFX_FFMPEG_RECORDER_LIBAV
+        m_Encoder.close();
+#endif
+        m_IsRecordingLibav = false;
+        m_AddedVideoFrames = 0;
+    }
+    else if (m_CustomRecordingFile)
     {
+        mBStopRequested = true;
+        m_Frames.close();
+        if (m_Thread.joinable())
+        {
+            joinThread();
+        }
 #if defined(_WIN32)
         _pclose(m_CustomRecordingFile);
 #else
@@ -562,7 +707,6 @@ void ofxFFmpegRecorder::cancel()
 #endif
         m_CustomRecordingFile = nullptr;
         m_AddedVideoFrames = 0;
-        joinThread();
     }
     else if (m_DefaultRecordingFile)
     {
@@ -656,12 +800,12 @@ void ofxFFmpegRecorder::clearAdditionalArguments()
 
 bool ofxFFmpegRecorder::isRecording() const
 {
-    return m_DefaultRecordingFile != nullptr || m_CustomRecordingFile != nullptr;
+    return m_DefaultRecordingFile != nullptr || isRecordingCustom();
 }
 
 bool ofxFFmpegRecorder::isRecordingCustom() const
 {
-    return m_CustomRecordingFile != nullptr;
+    return m_CustomRecordingFile != nullptr || m_IsRecordingLibav;
 }
 
 bool ofxFFmpegRecorder::isRecordingDefault() const
@@ -776,23 +920,98 @@ void ofxFFmpegRecorder::determineDefaultDevices()
 
 void ofxFFmpegRecorder::processFrame()
 {
-    while (isRecording() && !mBStopRequested)
+    // Sleeps in front() while the ring is empty, returns nullptr once stop() or cancel() closed it and it is drained
+    while (ofPixels *pixels = m_Frames.front())
     {
-        ofPixels *pixels = nullptr;
-        if (m_Frames.consume(pixels) && pixels)
+        if (!mBStopRequested)
         {
-            const unsigned char *data = pixels->getData();
-            const size_t dataLength = m_VideoSize.x * m_VideoSize.y * pixels->getNumChannels();
-            const size_t written = fwrite(data, sizeof(char), dataLength, m_CustomRecordingFile);
-            if (written <= 0)
+            auto start = std::chrono::high_resolution_clock::now();
+            if (!writeFrame(*pixels))
             {
                 LOG_WARNING("Cannot write the frame.");
             }
+            float seconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+            if (seconds > 0.f)
+            {
+                float fps = m_EncodeFps;
+                m_EncodeFps = fps == 0.f ? 1.f / seconds : fps + (1.f / seconds - fps) * 0.05f;
+            }
+        }
+
+        m_Frames.pop();
+    }
+}
+
+bool ofxFFmpegRecorder::writeFrame(const ofPixels &pixels)
+{
+#ifdef OFX_FFMPEG_RECORDER_LIBAV
+    if (m_IsRecordingLibav && m_IsConvertingYuv)
+    {
+        // Converted straight into the encoder's frame
+        uint8_t *planes[3];
+        int strides[3];
+        if (!m_Encoder.beginFrame(planes, strides))
+        {
+            return false;
+        }
+        m_YuvConverter->convert(pixels.getData(), pixels.getWidth(), pixels.getHeight(), pixels.getNumChannels(), planes, strides);
+        return m_Encoder.endFrame();
+    }
+    else if (m_IsRecordingLibav)
+    {
+        return m_Encoder.encode(pixels);
+    }
+#endif
+
+    if (m_IsConvertingYuv)
+    {
+        m_YuvConverter->convert(pixels.getData(), pixels.getWidth(), pixels.getHeight(), pixels.getNumChannels(), m_YuvFrame.data());
+        return fwrite(m_YuvFrame.data(), sizeof(char), m_YuvFrame.size(), m_CustomRecordingFile) > 0;
+    }
+
+    const unsigned char *data = pixels.getData();
+    const size_t dataLength = m_VideoSize.x * m_VideoSize.y * pixels.getNumChannels();
+    const size_t written = fwrite(data, sizeof(char), dataLength, m_CustomRecordingFile);
+    return written > 0;
+}
 
-            pixels->clear();
-            delete pixels;
+bool ofxFFmpegRecorder::startLibavRecord()
+{
+#ifdef OFX_FFMPEG_RECORDER_LIBAV
+    // "-crf 16" becomes the encoder option crf=16. Input arguments only concern the ffmpeg command line.
+    ofxFFmpegLibavEncoder::Options options;
+    for (const std::string &arg : m_AdditionalOutputArguments)
+    {
+        size_t split = arg.find(' ');
+        if (arg.size() < 2 || arg[0] != '-' || split == std::string::npos)
+        {
+            LOG_WARNING("Ignoring output argument " + arg + " for the in-process encoder.");
+            continue;
         }
+        options.emplace_back(arg.substr(1, split - 1), arg.substr(split + 1));
+    }
+
+    m_IsRecordingLibav = m_Encoder.open(ofToDataPath(m_OutputPath, true), m_VideoSize.x, m_VideoSize.y, m_Fps, m_VideCodec,
+                                        m_IsConvertingYuv ? "yuv420p" : mInputPixFmt, "yuv420p", options);
+    return m_IsRecordingLibav;
+#else
+    return false;
+#endif
+}
+
+void ofxFFmpegRecorder::pushFrame(const ofPixels &pixels)
+{
+    ofPixels &slot = m_Frames.acquire();
+    if (slot.getWidth() == pixels.getWidth() && slot.getHeight() == pixels.getHeight() && slot.getNumChannels() == pixels.getNumChannels())
+    {
+        std::memcpy(slot.getData(), pixels.getData(), pixels.getTotalBytes());
+    }
+    else
+    {
+        // Only when the frames differ from the size the recording was started with
+        slot = pixels;
     }
+    m_Frames.publish();
 }
 
 void ofxFFmpegRecorder::joinThread()
@@ -7,73 +7,133 @@
 #include "ofSoundBaseTypes.h"
 #include "ofRectangle.h"
 #include "ofPixels.h"
+#include "ofxFFmpegLibavEncoder.h"
+#include "YuvConverter.hpp"
 #if defined(TARGET_OSX) || defined(TARGET_LINUX)
 #include <thread>
-#include <list>
 #endif
+#include <atomic>
+#include <vector>
 
 using HighResClock = std::chrono::time_point<std::chrono::high_resolution_clock>;
 
 /**
- * LockFreeQueue is taken from here: https://github.com/timscaffidi/ofxVideoRecorder/blob/master/src/ofxVideoRecorder.h#L9
+ * @brief Fixed ring of preallocated frames between one producer (the render thread) and one consumer (the writer thread).
+ * The producer fills the slot returned by @ref acquire() and hands it over with @ref publish(), the consumer reads
+ * @ref front() and gives the slot back with @ref pop(). Both sides block on the indices instead of spinning: the producer
+ * while the ring is full, the consumer while it is empty. @ref close() wakes the consumer once the last frame is drained.
  */
-template <typename T>
-struct LockFreeQueue
+class FrameRing
 {
+public:
+    /**
+     * @brief Allocates `capacity` frames. Only call this while no thread is using the ring.
+     */
+    void reset(size_t capacity, size_t width, size_t height, size_t channels)
+    {
+        m_Slots.resize(std::max<size_t>(capacity, 1));
+        for (ofPixels &slot : m_Slots)
+        {
+            slot.allocate(width, height, channels);
+        }
+        m_Head.store(0);
+        m_Tail.store(0);
+    }
 
-    LockFreeQueue()
+    /**
+     * @brief Producer: returns the next free frame, waiting for the consumer if all of them are queued.
+     */
+    ofPixels &acquire()
     {
-        // Add one to validate the iterators
-        m_List.push_back(T());
-        m_HeadIt = m_List.begin();
-        m_TailIt = m_List.end();
+        const size_t head = m_Head.load(std::memory_order_relaxed) & ~ClosedBit;
+        size_t tail = m_Tail.load(std::memory_order_acquire);
+        while (head - tail == m_Slots.size())
+        {
+            m_Tail.wait(tail, std::memory_order_acquire);
+            tail = m_Tail.load(std::memory_order_acquire);
+        }
+        return m_Slots[head % m_Slots.size()];
     }
 
-    void produce(const T &t)
+    /**
+     * @brief Producer: queues the frame returned by the last @ref acquire().
+     */
+    void publish()
     {
-        m_List.push_back(t);
-        m_TailIt = m_List.end();
-        m_List.erase(m_List.begin(), m_HeadIt);
+        m_Head.fetch_add(1, std::memory_order_release);
+        m_Head.notify_one();
     }
 
-    bool consume(T &t)
+    /**
+     * @brief Producer: no more frames follow. The consumer still receives the queued ones.
+     */
+    void close()
     {
-        typename TList::iterator nextIt = m_HeadIt;
-        ++nextIt;
-        if (nextIt != m_TailIt)
+        m_Head.fetch_or(ClosedBit, std::memory_order_release);
+        m_Head.notify_one();
+    }
+
+    /**
+     * @brief Consumer: waits for the oldest queued frame. Returns nullptr once the ring is closed and empty.
+     */
+    ofPixels *front()
+    {
+        const size_t tail = m_Tail.load(std::memory_order_relaxed);
+        size_t head = m_Head.load(std::memory_order_acquire);
+        while ((head & ~ClosedBit) == tail)
         {
-            m_HeadIt = nextIt;
-            t = *m_HeadIt;
-            return true;
+            if (head & ClosedBit)
+            {
+                return nullptr;
+            }
+            m_Head.wait(head, std::memory_order_acquire);
+            head = m_Head.load(std::memory_order_acquire);
         }
-
-        return false;
+        return &m_Slots[tail % m_Slots.size()];
     }
 
-    int size() const
+    /**
+     * @brief Consumer: releases the frame returned by @ref front().
+     */
+    void pop()
     {
-        return std::distance(m_HeadIt, m_TailIt) - 1;
+        m_Tail.fetch_add(1, std::memory_order_release);
+        m_Tail.notify_one();
     }
 
-    typename std::list<T>::iterator getHead() const
+    size_t size() const
     {
-        return m_HeadIt;
+        return (m_Head.load(std::memory_order_acquire) & ~ClosedBit) - m_Tail.load(std::memory_order_acquire);
     }
 
-    typename std::list<T>::iterator getTail() const
+    size_t capacity() const
     {
-        return m_TailIt;
+        return m_Slots.size();
     }
 
 private:
-    using TList = std::list<T>;
-    TList m_List;
-    typename TList::iterator m_HeadIt, m_TailIt;
+    static constexpr size_t ClosedBit = size_t(1) << (sizeof(size_t) * 8 - 1);
+
+    std::vector<ofPixels> m_Slots;
+
+    // Frame counters, the slot is the counter modulo the capacity. The top bit of the head marks the ring closed.
+    std::atomic<size_t> m_Head{0};
+    std::atomic<size_t> m_Tail{0};
 };
 
 class ofxFFmpegRecorder
 {
 public:
+    /**
+     * @brief How custom recordings reach the encoder. Pipe writes raw frames to an ffmpeg process, Libav encodes them
+     * in-process and is only available when built with OFX_FFMPEG_RECORDER_LIBAV.
+     */
+    enum class Backend
+    {
+        Pipe,
+        Libav
+    };
+
     ofxFFmpegRecorder();
     ~ofxFFmpegRecorder();
 
@@ -129,6 +189,13 @@ public:
     void setInputPixelFormat(ofImageType aType);
     void setOutputPixelFormat(ofImageType aType);
 
+    /**
+     * @brief Selects the backend for the next @ref startCustomRecord(). Libav falls back to Pipe if it was not built in.
+     */
+    void setBackend(Backend backend);
+    Backend getBackend() const;
+    static bool isLibavAvailable();
+
     /**
      * @brief Returns the record duration for the custom recording. This will return 0 for the webcam recording.
      * @return
@@ -163,6 +230,30 @@ public:
      */
     size_t addSingleFrame(const ofPixels &pixels);
 
+    /**
+     * @brief Number of frames the writer thread can fall behind by. Adding a frame blocks while this many are queued.
+     * Takes effect with the next @ref startCustomRecord().
+     */
+    void setFrameQueueSize(size_t frames);
+    size_t getFrameQueueSize() const;
+
+    /**
+     * @brief Number of frames waiting to be written to ffmpeg.
+     */
+    size_t getNumQueuedFrames() const;
+
+    /**
+     * @brief Frames per second the writer thread gets through, measured over the time spent writing or encoding.
+     */
+    float getEncodeFps() const;
+
+    /**
+     * @brief If enabled (the default), colour frames are converted to yuv420p (BT.709, limited range) on the writer thread
+     * before they reach the encoder, instead of passing rgb24 on. Takes effect with the next @ref startCustomRecord().
+     */
+    void setConvertToYuv(bool convert);
+    bool isConvertToYuv() const;
+
     void stop();
 
     /**
@@ -242,8 +333,6 @@ public:
     void saveThumbnail(const unsigned int &hour, const unsigned int &minute, const float &second, const std::string &output, glm::vec2 size = glm::vec2(0, 0),
                        ofRectangle crop = ofRectangle(0, 0, 0, 0), std::string videoFilePath = "");
 
-    LockFreeQueue<ofPixels *> m_Frames;
-
 private:
     std::string m_FFmpegPath, m_OutputPath;
     bool m_IsRecordVideo, m_IsRecordAudio;
@@ -296,7 +385,32 @@ private:
     std::string mInputPixFmt = "rgb24";
     std::string mOutputPixFmt = "rgb24";
 
-    bool mBStopRequested = false;
+    /**
+     * @brief Frames on their way to the writer thread
+     */
+    FrameRing m_Frames;
+    size_t m_FrameQueueSize = 8;
+
+    Backend m_Backend = Backend::Pipe;
+    bool m_IsRecordingLibav = false;
+#ifdef OFX_FFMPEG_RECORDER_LIBAV
+    ofxFFmpegLibavEncoder m_Encoder;
+#endif
+
+    /**
+     * @brief Moving average, written by the writer thread
+     */
+    std::atomic<float> m_EncodeFps = 0.f;
+
+    bool m_ConvertYuv = true;
+    bool m_IsConvertingYuv = false;
+    std::unique_ptr<YuvConverter> m_YuvConverter;
+    std::vector<uint8_t> m_YuvFrame;
+
+    /**
+     * @brief Set by @ref cancel(), the writer thread then drops the queued frames instead of writing them.
+     */
+    std::atomic<bool> mBStopRequested = false;
 
 private:
     /**
@@ -309,4 +423,19 @@ private:
      */
     void processFrame();
     void joinThread();
+
+    /**
+     * @brief Copies `pixels` into the next free frame of the ring, blocking while the ring is full.
+     */
+    void pushFrame(const ofPixels &pixels);
+
+    /**
+     * @brief Opens the in-process encoder, with the additional output arguments as encoder options.
+     */
+    bool startLibavRecord();
+
+    /**
+     * @brief Writes one frame to ffmpeg's input or the in-process encoder.
+     */
+    bool writeFrame(const ofPixels &pixels);
 };